@@ -6,17 +6,65 @@
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <sys/stat.h>
 
 // Include CNFG (rawdraw) for generating a window and/or OpenGL context.
 // Included to manage windows header files, but may be used more explicitly in the future.
 #define CNFG_IMPLEMENTATION
 #define CNFGOGL
+#define CNFGOGL_NEED_EXTENSION	// so CNFGGetProcAddress is there off Windows too
 #include "rawdraw_sf.h"
 
 // Include OpenVR header so we can interact with VR stuff.
 #undef EXTERN_C
 #include "openvr_capi.h"
 
+// Threads and time, we use it for the monotonic clock.
+#include "os_generic.h"
+
+// Everything else we need from Windows (or Linux, for testing).
+#include "piss_platform.h"
+
+// The capture schedule engine, decides when screenshots are taken.
+#include "piss_schedule.h"
+
+// Notices when the wall clock gets changed or the machine was asleep.
+#include "piss_clock.h"
+
+// Histograms for keeping track of how long captures take.
+#include "piss_stats.h"
+
+// Looks at compositor frame timings to pick a quiet moment for screenshots.
+#include "piss_frametiming.h"
+
+// Poses, app and frame timing recorded with each capture.
+#include "piss_sidecar.h"
+
+// Keeps track of the screenshots SteamVR is still working on.
+#include "piss_handles.h"
+#include "piss_workers.h"
+
+// A cheap mono capture from the compositor mirror texture, read back through pixel buffers.
+#include "piss_mirror.h"
+
+// The last few seconds of small mirror frames, kept compressed in memory.
+#include "piss_replay.h"
+
+// Every path we use, worked out once at startup, and the screenshot name template.
+#include "piss_paths.h"
+
+// Remembers which screenshot folders are already there.
+#include "piss_folders.h"
+
+// Every capture, in order, in one file with a time index.
+#include "piss_catalog.h"
+
+// Searching the catalog without loading it.
+#include "piss_catalogreader.h"
+
+// Checks a run against the virtual clock took every capture it should have.
+#include "piss_simulate.h"
+
 // OpenVR Doesn't define these for some reason (I don't remember why) so we define the functions here. They are copy-pasted from the bottom of openvr_capi.h
 intptr_t VR_InitInternal( EVRInitError *peError, EVRApplicationType eType );
 void VR_ShutdownInternal();
@@ -48,116 +96,2911 @@ void * CNOVRGetOpenVRFunctionTable( const char * interfacename )
 }
 
 // These are interfaces into OpenVR, they are basically function call tables.
-//struct VR_IVRSystem_FnTable * oSystem;
+struct VR_IVRSystem_FnTable * oSystem;
 //struct VR_IVROverlay_FnTable * oOverlay;
 struct VR_IVRApplications_FnTable * oApplications;
 struct VR_IVRScreenshots_FnTable * oScreenshots;
+struct VR_IVRCompositor_FnTable * oCompositor;
 //struct VR_IVRInput_FnTable * oInput;
 
+// Everything next to the exe. These all point into paths' arena and are set once by PathsInit().
+struct Paths paths;
+const char * configPath;
+const char * statsPath;
+const char * manifestPath;
+const char * screenshotsFolder;
+const char * sidecarPath;
+const char * indexPath;
+const char * catalogPath;
+const char * catalogIndexPath;
+const char * benchPath;
+const char * catalogBenchPath;
+const char * catalogBenchIndexPath;
+const char * benchSidecarPath;		// what --bench records its captures in instead, see BenchUseScratchFiles()
+const char * benchIndexPath;
+const char * benchCatalogPath;
+const char * benchCatalogIndexPath;
 
-int main()
+void PathsInit()
 {
-    // We put this in a codeblock because it's logically together.
-	// no reason to keep the token around.
+	char exeDirectory[_MAX_PATH];
+	PlatformExeDirectory( exeDirectory );
+	PathsStart( &paths, exeDirectory );
+	configPath = PathsAddFile( &paths, "PISS.cfg" );
+	statsPath = PathsAddFile( &paths, "PISS-latency.txt" );
+	manifestPath = PathsAddFile( &paths, "PISS.vrmanifest" );
+	screenshotsFolder = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING );
+	sidecarPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "captures.bin" );
+	indexPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "index.txt" );
+	benchPath = PathsAddFile( &paths, "PISS-bench.json" );
+	catalogPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "catalog.bin" );
+	catalogIndexPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "catalog.idx" );
+	catalogBenchPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "catalog-bench.bin" );
+	catalogBenchIndexPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "catalog-bench.idx" );
+	benchSidecarPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "bench-captures.bin" );
+	benchIndexPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "bench-index.txt" );
+	benchCatalogPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "bench-catalog.bin" );
+	benchCatalogIndexPath = PathsAddFile( &paths, "Screenshots" PLATFORM_SEPARATOR_STRING "bench-catalog.idx" );
+	PathsCompile( &paths, DEFAULT_NAME_TEMPLATE );
+}
+
+// Screenshot folders we've already made. folderWatch tells us when a folder under the exe's is
+// renamed or deleted, and then we forget them all and make them again as needed. A screenshot
+// failing to save because its folder isn't there does the same, in case the watch couldn't be
+// set up.
+struct Folders folders;
+struct PlatformWatch folderWatch;
+
+void FoldersInit()
+{
+	PlatformMakeFolder( screenshotsFolder );
+	PlatformWatchStart( &folderWatch, paths.root );
+	PlatformWatchAdd( &folderWatch, screenshotsFolder );
+}
+
+// Makes the folders a screenshot is going into, if they might not be there.
+bool MakeScreenshotFolders( char * path )
+{
+	if( PlatformWatchChanged( &folderWatch ) )
 	{
-		EVRInitError ierr;
-		uint32_t token = VR_InitInternal( &ierr, EVRApplicationType_VRApplication_Overlay );
-		if( !token )
+		FoldersForget( &folders );
+		// In case it was Screenshots itself that went away and came back.
+		PlatformWatchAdd( &folderWatch, screenshotsFolder );
+	}
+	return FoldersMake( &folders, path, paths.rootLength, PlatformMakeFolder );
+}
+
+// The capture timer. Rather than waking up every half second to check if the hour changed,
+// we work out when the next screenshot is due and ask the OS to wake us at exactly that time.
+// The timer is given an absolute UTC due time, so it also follows changes to the system clock.
+struct PlatformTimer captureTimer;
+int timerWakeups;			// number of times the wait returned, for keeping an eye on wakeups per hour
+time_t timerStart;			// when we started counting wakeups
+
+// Normally every clock we read is the real one, but --simulate swaps them all for a virtual
+// clock that only moves when the main loop waits, and then straight to what it was waiting for.
+struct VirtualClock
+{
+	bool on;
+	double now;					// seconds since 1970
+	double end;					// the main loop stops once it gets here
+};
+struct VirtualClock virtualClock;
+
+// The wall clock, use this rather than time(NULL).
+time_t ClockNow()
+{
+	return virtualClock.on ? (time_t)virtualClock.now : time(NULL);
+}
+
+// The wall clock as seconds since 1970, but with sub-millisecond precision unlike time().
+double WallClockNow()
+{
+	return virtualClock.on ? virtualClock.now : PlatformWallClock();
+}
+
+// The monotonic clock. The virtual clock never gets moved by anyone, so it's both.
+double MonotonicNow()
+{
+	return virtualClock.on ? virtualClock.now : OGGetAbsoluteTime();
+}
+
+void CaptureTimerInit()
+{
+	if( !PlatformTimerStart( &captureTimer ) )
+	{
+		printf( "Error!!!! Could not create capture timer\n" );
+		exit( 1 );
+	}
+	timerStart = ClockNow();
+}
+
+// OpenVR doesn't give us anything we can wait on for events, so while we wait for the timer we
+// also come up every so often to call PollNextEvent. While nothing is happening that's only for
+// things like SteamVR asking us to quit, so once a second is plenty, and far fewer wakeups than
+// the old half second sleep. While a screenshot is being written we check much more often, so
+// we hear about it finishing within a few milliseconds (see EventPollWait()).
+int eventPollMs = 1000;
+#define BUSY_EVENT_POLL_MS 5
+int eventPolls;				// times we woke up just to look for events
+
+time_t armedDeadline;		// what the timer is currently set for, so we don't set it again every poll
+double timerFiredAt;		// wall clock when the timer last went off, for measuring how late captures are
+
+// Waits until the wall clock reaches deadline, or timeoutMs passes. Returns true if it was the
+// deadline. The deadline can come a little early if the clock is changed, so the caller should
+// check the time again afterwards.
+bool CaptureTimerWait( time_t deadline, int timeoutMs )
+{
+	if( virtualClock.on )
+	{
+		// There are never any events, so the usual polls can be skipped. The quick ones while
+		// captures are in flight still matter, that's when the next queued one gets started.
+		if( timeoutMs < eventPollMs && virtualClock.now + timeoutMs / 1000.0 < deadline )
 		{
-			printf( "Error!!!! Could not initialize OpenVR\n" );
-			return -5;
+			virtualClock.now += timeoutMs / 1000.0;
+			eventPolls++;
+			return false;
+		}
+		if( virtualClock.now < deadline )
+		{
+			virtualClock.now = deadline;
+		}
+		timerFiredAt = virtualClock.now;
+		timerWakeups++;
+		return true;
+	}
+	if( deadline != armedDeadline )
+	{
+		if( !PlatformTimerSet( &captureTimer, deadline ) )
+		{
+			// Should never happen, but don't spin if it does.
+			PlatformSleepMs( timeoutMs );
+			timerFiredAt = WallClockNow();
+			return true;
 		}
+		armedDeadline = deadline;
+	}
 
-		// Get the system and overlay interfaces.  We pass in the version of these
-		// interfaces that we wish to use, in case the runtime is newer, we can still
-		// get the interfaces we expect.
-		//oSystem = CNOVRGetOpenVRFunctionTable( IVRSystem_Version );
-		//oOverlay = CNOVRGetOpenVRFunctionTable( IVROverlay_Version );
-		oApplications = CNOVRGetOpenVRFunctionTable( IVRApplications_Version );
-		oScreenshots = CNOVRGetOpenVRFunctionTable( IVRScreenshots_Version );
-		//oInput = CNOVRGetOpenVRFunctionTable( IVRInput_Version );
+	if( PlatformTimerWait( &captureTimer, timeoutMs ) )
+	{
+		// It has to be set again before we wait on it next time.
+		armedDeadline = 0;
+		timerFiredAt = WallClockNow();
+		timerWakeups++;
+		return true;
+	}
+	eventPolls++;
+	return false;
+}
+
+// Every capture goes through four points: when it was scheduled, when the loop woke up for it,
+// when the screenshot call returned, and when SteamVR told us the files were written. We keep
+// a histogram of the time between each, so changes to the scheduler can be measured.
+struct Histogram fireLatency;		// scheduled -> noticed
+struct Histogram gateDelay;			// noticed -> frame timings looked calm enough to go ahead
+struct Histogram requestTime;		// screenshot call made -> returned
+struct Histogram writeTime;			// call returned -> files on disk
+struct Histogram totalLatency;		// scheduled -> files on disk
+struct Histogram pathTime;			// making a screenshot's file name, in nanoseconds
+int failedCaptures;
+
+// Set from the console handler when someone presses Ctrl+Break (Ctrl+\ on Linux), the main
+// loop then prints out the timings and writes them to PISS-latency.txt.
+volatile int statsRequested;
+
+// Screenshots we're waiting for SteamVR to finish writing. If we never hear back about one we
+// stop waiting after a while so we don't sit in fast polling forever.
+struct HandleTable captures;
+#define PENDING_SCREENSHOT_TIMEOUT 30.0
+
+// Burst mode: each capture is burst_count screenshots, at least burst_spacing_ms apart. SteamVR
+// only does one screenshot at a time (asking for another gets ScreenshotAlreadyInProgress), so
+// the next one is asked for as soon as the last one has finished, unless that's too soon.
+int burstCount = 1;
+int burstSpacingMs = 0;
+
+struct Burst
+{
+	bool active;
+	struct CaptureRequest request;	// request.shot is the one up next
+	double lastRequest;
+};
+struct Burst burst;
+
+// When SteamVR turns a screenshot down with RequestFailed or AlreadyInProgress, or it fails
+// while saving, it's usually just the compositor being busy for a moment. Rather than losing
+// the whole capture we try again after retry_initial_ms, doubling the wait each time up to
+// RETRY_MAX_BACKOFF_MS, and give up once retry_deadline seconds have passed since the first go.
+int retryInitialMs = 250;
+int retryDeadline = 60;
+#define RETRY_MAX_BACKOFF_MS 8000
+
+struct Retry
+{
+	bool active;
+	struct CaptureRequest request;
+	int attempts;
+	double firstAttempt;
+	double nextAttempt;
+};
+struct Retry retry;
+int retriesGivenUp;
+int retriesSucceeded;
+
+// How many times TakeStereoScreenshot has returned each error code.
+#define MAX_SCREENSHOT_ERROR 128
+int screenshotErrors[MAX_SCREENSHOT_ERROR + 1];
+
+void CountScreenshotError( EVRScreenshotError err )
+{
+	screenshotErrors[( err >= 0 && err < MAX_SCREENSHOT_ERROR ) ? err : MAX_SCREENSHOT_ERROR]++;
+}
+
+bool ScreenshotErrorRetryable( EVRScreenshotError err )
+{
+	return err == EVRScreenshotError_VRScreenshotError_RequestFailed ||
+		err == EVRScreenshotError_VRScreenshotError_ScreenshotAlreadyInProgress;
+}
+
+bool SameShot( const struct CaptureRequest * a, const struct CaptureRequest * b )
+{
+	return a->scheduled == b->scheduled && a->type == b->type && a->shot == b->shot && a->hookHandle == b->hookHandle;
+}
+
+// Sets up (or moves on) the retry for a shot that just failed. Returns false if we've given up.
+bool ScheduleRetry( const struct CaptureRequest * request )
+{
+	double now = WallClockNow();
+	if( !retry.active || !SameShot( &retry.request, request ) )
+	{
+		retry.request = *request;
+		retry.attempts = 0;
+		retry.firstAttempt = now;
 	}
+	retry.attempts++;
+	retry.request.attempt = retry.attempts;
 
+	double backoffMs = retryInitialMs;
+	for( int i = 1; i < retry.attempts && backoffMs < RETRY_MAX_BACKOFF_MS; i++ )
 	{
-		if (!oApplications->IsApplicationInstalled("iigo.PISS"))
+		backoffMs *= 2;
+	}
+	if( backoffMs > RETRY_MAX_BACKOFF_MS )
+	{
+		backoffMs = RETRY_MAX_BACKOFF_MS;
+	}
+
+	if( now + backoffMs / 1000.0 > retry.firstAttempt + retryDeadline )
+	{
+		printf( "Giving up on screenshot after %d tries.\n", retry.attempts );
+		retry.active = false;
+		retriesGivenUp++;
+		return false;
+	}
+	printf( "Trying screenshot again in %.0f ms.\n", backoffMs );
+	retry.active = true;
+	retry.nextAttempt = now + backoffMs / 1000.0;
+	return true;
+}
+
+// There's no point taking a screenshot when nobody is in VR. Before each capture we check that
+// the headset is connected, being worn (going by its activity level, which follows the
+// proximity sensor) and tracking, and that there's a game running. If not, the capture is
+// either skipped, taken anyway, or deferred until things change (for at most defer_limit).
+enum IdleAction
+{
+	IdleAction_Take,
+	IdleAction_Skip,
+	IdleAction_Defer,
+};
+enum CaptureBlocker
+{
+	CaptureBlocker_None,
+	CaptureBlocker_Idle,		// headset not connected, worn or tracking
+	CaptureBlocker_NoScene,		// no scene application running
+};
+int whenIdle = IdleAction_Skip;
+int whenNoScene = IdleAction_Skip;
+int deferLimit = 300;
+
+struct DeferredCapture
+{
+	bool active;
+	struct CaptureRequest request;
+	time_t since;
+	int blocker;
+};
+struct DeferredCapture deferredCapture;
+
+int capturesTaken;
+int capturesSkippedIdle;
+int capturesSkippedNoScene;
+int capturesDeferred;
+double bytesWritten;		// size of all the screenshots we've measured, for working out what skipping saves
+int capturesMeasured;
+
+// Returns CaptureBlocker_None if it's worth taking a screenshot right now, otherwise what's in
+// the way, with why set to something to tell the user.
+int WhyNotCapture( const char ** why )
+{
+	if( !oSystem->IsTrackedDeviceConnected( k_unTrackedDeviceIndex_Hmd ) )
+	{
+		*why = "headset not connected";
+		return CaptureBlocker_Idle;
+	}
+
+	// UserInteraction_Timeout just means it hasn't moved for a few seconds, which happens when
+	// sitting still watching something, so only standby and idle count as nobody there.
+	EDeviceActivityLevel level = oSystem->GetTrackedDeviceActivityLevel( k_unTrackedDeviceIndex_Hmd );
+	if( level == EDeviceActivityLevel_k_EDeviceActivityLevel_Idle ||
+		level == EDeviceActivityLevel_k_EDeviceActivityLevel_Standby ||
+		level == EDeviceActivityLevel_k_EDeviceActivityLevel_Idle_Timeout )
+	{
+		*why = "headset not being worn";
+		return CaptureBlocker_Idle;
+	}
+
+	TrackedDevicePose_t pose;
+	oSystem->GetDeviceToAbsoluteTrackingPose( ETrackingUniverseOrigin_TrackingUniverseStanding, 0, &pose, 1 );
+	if( !pose.bPoseIsValid || pose.eTrackingResult != ETrackingResult_TrackingResult_Running_OK )
+	{
+		*why = "headset not tracking";
+		return CaptureBlocker_Idle;
+	}
+
+	if( !oApplications->GetCurrentSceneProcessId() )
+	{
+		*why = "no game running";
+		return CaptureBlocker_NoScene;
+	}
+	return CaptureBlocker_None;
+}
+
+int ParseIdleAction( const char * value )
+{
+	char action[16] = "";
+	sscanf( value, "%15s", action );
+	if( strcmp( action, "take" ) == 0 ) return IdleAction_Take;
+	if( strcmp( action, "skip" ) == 0 ) return IdleAction_Skip;
+	if( strcmp( action, "defer" ) == 0 ) return IdleAction_Defer;
+	return -1;
+}
+
+long long FileSize( const char * path )
+{
+	struct stat st;
+	return stat( path, &st ) == 0 ? (long long)st.st_size : -1;
+}
+
+// Asking the compositor for a screenshot in the middle of a hitch makes the hitch worse, so
+// before each capture we wait (at most frame_gate_ms) until the last frame_gate_frames frames
+// were all on time. With frame_gate_compare every other capture skips the wait, so the frame
+// cost of gated and ungated captures can be compared on the same machine and game.
+int frameGateMs = 2000;
+int frameGateFrames = 10;
+bool frameGateCompare;
+struct FrameCost frameCost[2];		// [0] ungated, [1] gated
+
+// Each kind of screenshot costs the compositor and the disk very different amounts, so the
+// frame cost, time to save and file size are also kept per type to help budget them.
+// Mirror captures aren't a SteamVR screenshot type, so they get the next number along.
+#define SCREENSHOT_TYPE_MIRROR 6
+#define SCREENSHOT_TYPES 7
+struct TypeStats
+{
+	struct FrameCost cost;
+	struct Histogram requestTime;	// main thread time spent asking for it
+	struct Histogram writeTime;
+	double bytes;
+	int measured;
+};
+struct TypeStats typeStats[SCREENSHOT_TYPES];
+
+struct ScreenshotTypeName
+{
+	const char * name;
+	EVRScreenshotType type;
+};
+const struct ScreenshotTypeName screenshotTypeNames[] = {
+	{ "stereo", EVRScreenshotType_VRScreenshotType_Stereo },
+	{ "mono", EVRScreenshotType_VRScreenshotType_Mono },
+	{ "cubemap", EVRScreenshotType_VRScreenshotType_Cubemap },
+	{ "panorama", EVRScreenshotType_VRScreenshotType_MonoPanorama },
+	{ "stereopanorama", EVRScreenshotType_VRScreenshotType_StereoPanorama },
+	{ "mirror", SCREENSHOT_TYPE_MIRROR },
+};
+
+// Returns the EVRScreenshotType for a name from the config, stereo for an empty name, or -1.
+int ParseScreenshotType( const char * name )
+{
+	if( !name[0] )
+	{
+		return EVRScreenshotType_VRScreenshotType_Stereo;
+	}
+	for( int i = 0; i < sizeof( screenshotTypeNames ) / sizeof( screenshotTypeNames[0] ); i++ )
+	{
+		if( strcmp( name, screenshotTypeNames[i].name ) == 0 )
 		{
-			char path_buffer[_MAX_PATH];
-			char drive[_MAX_DRIVE];
-			char dir[_MAX_DIR];
-			char fname[_MAX_FNAME];
-			char ext[_MAX_EXT];
-
-			// Gets the path of the exe file
-			GetModuleFileName( NULL, path_buffer, sizeof(path_buffer));
-			_splitpath( path_buffer, drive, dir, fname, ext );
-			_makepath( path_buffer, drive, dir, NULL, NULL ); // removes the file name and extension from the buffer
-			strncat(path_buffer, "PISS.vrmanifest", sizeof("PISS.vrmanifest"));
-			EVRApplicationError app_error;
-			app_error = oApplications->AddApplicationManifest(path_buffer, false);
+			return screenshotTypeNames[i].type;
+		}
+	}
+	return -1;
+}
 
-			//printf( "%s (%d).\n", path_buffer, app_error );
+const char * ScreenshotTypeName( int type )
+{
+	for( int i = 0; i < sizeof( screenshotTypeNames ) / sizeof( screenshotTypeNames[0] ); i++ )
+	{
+		if( screenshotTypeNames[i].type == type )
+		{
+			return screenshotTypeNames[i].name;
 		}
 	}
+	return "unknown";
+}
 
-	time_t now = time(NULL);
-	//time_t now = 1667707200; // 2022 Nov 6th at midnight
-	//time_t now = 1678597200; // 2023 Mar 12th at midnight
-	int hoursSinceEpoch = now / 3600;
-	int sshour = hoursSinceEpoch;
+struct FrameGate
+{
+	bool active;
+	struct CaptureRequest request;
+	double since;
+};
+struct FrameGate frameGate;
+int capturesStarted;
 
-    while( true )
-    {
+// Fills timings with up to FRAME_TIMING_HISTORY recent frames, oldest first. Returns how many.
+int GetRecentFrameTimings( Compositor_FrameTiming * timings )
+{
+	timings[0].m_nSize = sizeof( Compositor_FrameTiming );
+	return oCompositor->GetFrameTimings( timings, FRAME_TIMING_HISTORY );
+}
+
+bool FramesAreStable()
+{
+	Compositor_FrameTiming timings[FRAME_TIMING_HISTORY];
+	int count = GetRecentFrameTimings( timings );
+	return FrameTimingsStable( timings, count, frameGateFrames );
+}
+
+// Completion handlers, called when SteamVR tells us how each of our screenshots went.
+
+void RecordCaptureTimings( struct PendingCapture * pc, bool ok )
+{
+	if( !ok )
+	{
+		failedCaptures++;
+		return;
+	}
+	HistogramRecordSeconds( &writeTime, pc->resolved - pc->returned );
+	if( !pc->late )
+	{
+		HistogramRecordSeconds( &totalLatency, pc->resolved - pc->request.scheduled );
+	}
+}
+
+void RecordFrameCost( struct PendingCapture * pc, bool ok )
+{
+	Compositor_CumulativeStats statsAfter;
+	oCompositor->GetCumulativeStats( &statsAfter, sizeof( statsAfter ) );
+	struct FrameCost cost = FrameCostAdd( &frameCost[pc->request.gated], &pc->statsBefore, &statsAfter, pc->baseline );
+	FrameCostAdd( &typeStats[pc->request.type].cost, &pc->statsBefore, &statsAfter, pc->baseline );
+	printf( "Screenshot %u cost %.1f extra dropped and %.1f extra reprojected frames (%s).\n", pc->handle,
+		cost.extraDropped, cost.extraReprojected, pc->request.gated ? "gated" : "ungated" );
+}
+
+// Mirror captures go through the same handle table as SteamVR's screenshots, with made up
+// handles SteamVR will never give out. They're done when the pixels are back from the GPU.
+#define MIRROR_HANDLE_BASE 0x80000000u
+struct Mirror mirror;
+uint32_t mirrorCaptures;
+struct Histogram mirrorGpuTime;
+
+struct MirrorSlot * MirrorSlotFor( ScreenshotHandle_t handle )
+{
+	for( int i = 0; i < MIRROR_SLOTS; i++ )
+	{
+		if( mirror.slots[i].handle == handle && atomic_load( &mirror.slots[i].state ) != MirrorSlot_Free )
+		{
+			return &mirror.slots[i];
+		}
+	}
+	return NULL;
+}
+
+EVRScreenshotError TakeMirrorScreenshot( ScreenshotHandle_t * handle )
+{
+	if( !mirror.ready )
+	{
+		return EVRScreenshotError_VRScreenshotError_NotFound;
+	}
+	struct MirrorSlot * slot = MirrorRead( &mirror, oCompositor, MIRROR_HANDLE_BASE | ++mirrorCaptures, 1 );
+	if( !slot )
+	{
+		return EVRScreenshotError_VRScreenshotError_ScreenshotAlreadyInProgress;
+	}
+	*handle = slot->handle;
+	return EVRScreenshotError_VRScreenshotError_None;
+}
+
+// Instant replay keeps its own stream of mirror frames going, with handles of its own.
+#define REPLAY_HANDLE_BASE 0x40000000u
+struct Replay replay;
+double replaySeconds;			// 0 is off
+int replayFps = 5;
+int replayMemoryMb = 64;
+int replayScale = 4;
+uint32_t replayFrames;
+double nextReplayFrame;
+int replaysSaved;
+char replayFolder[_MAX_PATH];	// where the replay being saved goes, left alone while replay.saving is set
 
-		//now = now + 1; //increase time by one second each while loop
-		now = time(NULL);
-		
-		hoursSinceEpoch = now / 3600;
-		struct tm *tm_struct = gmtime(&now);
+int ReplayIntervalMs()
+{
+	return 1000 / replayFps;
+}
+
+// Starts copying the next replay frame when it's due.
+void ServiceReplayFrames()
+{
+	if( !replay.enabled || !mirror.ready )
+	{
+		return;
+	}
+	double now = OGGetAbsoluteTime();
+	if( now < nextReplayFrame )
+	{
+		return;
+	}
+	nextReplayFrame += 1.0 / replayFps;
+	if( nextReplayFrame < now )
+	{
+		nextReplayFrame = now + 1.0 / replayFps;
+	}
+	if( atomic_load( &replay.saving ) || !MirrorRead( &mirror, oCompositor, REPLAY_HANDLE_BASE | ( ++replayFrames & 0x3fffffff ), replay.scale ) )
+	{
+		replay.framesDropped++;
+	}
+}
 
-		// check to see if its a new hour
-		if (sshour != hoursSinceEpoch)
+// Picks up mirror captures the GPU has finished with and resolves them like any other screenshot.
+void ServiceMirror()
+{
+	if( !mirror.ready )
+	{
+		return;
+	}
+	CNFGHandleInput();
+	struct MirrorSlot * slot;
+	while( ( slot = MirrorPoll( &mirror ) ) )
+	{
+		if( !( slot->handle & MIRROR_HANDLE_BASE ) )
+		{
+			// Whatever shrinking the GPU didn't do is left to the replay.
+			ReplayAdd( &replay, slot->pixels, slot->width, slot->height, slot->scale > 1 ? 1 : replay.scale, OGGetAbsoluteTime() );
+			atomic_store( &slot->state, MirrorSlot_Free );
+			continue;
+		}
+		HistogramRecordSeconds( &typeStats[SCREENSHOT_TYPE_MIRROR].requestTime, slot->cpuSeconds );
+		HistogramRecordSeconds( &mirrorGpuTime, slot->gpuSeconds );
+		if( !HandleTableResolve( &captures, slot->handle, slot->width > 0, WallClockNow() ) || slot->width <= 0 )
 		{
+			// Already given up on, or nothing came back, so there's nothing to save.
+			atomic_store( &slot->state, MirrorSlot_Free );
+		}
+	}
+}
+
+// Everything done to a screenshot once it's saved runs on the worker pool, one step after the
+// other: measure the files, hash them, then add a line about them to the index.
+enum PostCaptureJob
+{
+	PostCapture_SaveMirror,
+	PostCapture_SaveReplay,
+	PostCapture_WriteSidecar,
+	PostCapture_WriteCatalog,
+	PostCapture_Measure,
+	PostCapture_Hash,
+	PostCapture_Index,
+	POST_CAPTURE_JOBS
+};
+const char * postCaptureJobNames[POST_CAPTURE_JOBS] = { "save mirror", "save replay", "sidecar", "catalog", "measure", "hash", "index" };
 
-			char path_buffer[_MAX_PATH];
-			char drive[_MAX_DRIVE];
-			char dir[_MAX_DIR];
-			char fname[_MAX_FNAME];
-			char ext[_MAX_EXT];
+int workerThreads = 2;
+struct WorkerPool workers;
+struct Histogram jobWait[POST_CAPTURE_JOBS];	// queued -> picked up by a worker
+struct Histogram jobRun[POST_CAPTURE_JOBS];		// picked up -> done
+struct Histogram queueDepth;					// jobs waiting each time one is added (a count, not a time)
+int jobsRunInline;								// the queue was full, so the main thread did them itself
+int imagesIndexed;								// screenshots that made it all the way through
+og_mutex_t indexLock;
 
+// FNV-1a over the contents of a file, carrying on from hash.
+uint64_t HashFile( const char * path, uint64_t hash )
+{
+	FILE * f = fopen( path, "rb" );
+	if( !f )
+	{
+		return hash;
+	}
+	unsigned char buffer[16384];
+	size_t got;
+	while( ( got = fread( buffer, 1, sizeof( buffer ), f ) ) > 0 )
+	{
+		for( size_t i = 0; i < got; i++ )
+		{
+			hash = ( hash ^ buffer[i] ) * 0x100000001b3ULL;
+		}
+	}
+	fclose( f );
+	return hash;
+}
 
-			// Gets the path of the exe file
-			GetModuleFileName( NULL, path_buffer, sizeof(path_buffer));
-			_splitpath( path_buffer, drive, dir, fname, ext );
-			_makepath( path_buffer, drive, dir, NULL, NULL ); // removes the file name and extension from the buffer
-			char ssFolderName[] = "Screenshots\\";
-			strncat(path_buffer, ssFolderName, sizeof(ssFolderName));
-			CreateDirectory(path_buffer, NULL);
-			char ssMonthFolder[] = "0000-00\\";
-			strftime(ssMonthFolder, sizeof ssMonthFolder, "%Y-%m\\", tm_struct);
-			strncat(path_buffer, ssMonthFolder, sizeof ssMonthFolder);
-			CreateDirectory(path_buffer, NULL);
+// Runs on a worker thread.
+int RunPostCaptureJob( struct WorkerJob * job )
+{
+	struct PendingCapture * pc = job->capture;
+	const char * preview = pc ? pc->previewFile : NULL;
+	const char * vr = pc ? pc->vrFile : NULL;
 
-			char timestamp[] = "2011-10-08_07-07-09";
-			char screenshotpath[sizeof path_buffer + sizeof timestamp];
-			strcpy(screenshotpath, path_buffer);
-			strftime(timestamp, sizeof timestamp, "%Y-%m-%d_%H-%M-%S", tm_struct);
-			strncat(screenshotpath, timestamp, sizeof timestamp);
-			char screenshotpathvr[sizeof screenshotpath + 4];
-			strcpy(screenshotpathvr, screenshotpath);
-			strncat(screenshotpathvr, "_VR", 4);
+	switch( job->kind )
+	{
+	case PostCapture_SaveMirror:
+	{
+		struct MirrorSlot * slot = job->data;
+		bool saved = MirrorWriteBMP( vr, slot->pixels, slot->width, slot->height );
+		atomic_store( &slot->state, MirrorSlot_Free );
+		job->bytes = saved ? 0 : -1;
+		return saved ? PostCapture_Measure : -1;
+	}
+	case PostCapture_SaveReplay:
+		PlatformMakeFolder( replayFolder );
+		ReplaySave( job->data, replayFolder, PLATFORM_SEPARATOR );
+		return -1;
+	case PostCapture_WriteSidecar:
+		SidecarWrite( job->data, sidecarPath );
+		return -1;
+	case PostCapture_WriteCatalog:
+		CatalogWrite( job->data, catalogPath, catalogIndexPath );
+		return -1;
+	case PostCapture_Measure:
+	{
+		// Mirror captures don't have a preview.
+		long long previewBytes = preview[0] ? FileSize( preview ) : 0;
+		long long vrBytes = FileSize( vr );
+		job->bytes = previewBytes >= 0 && vrBytes >= 0 ? previewBytes + vrBytes : -1;
+		job->previewBytes = preview[0] ? previewBytes : -1;
+		return job->bytes >= 0 ? PostCapture_Hash : -1;
+	}
+	case PostCapture_Hash:
+		job->hash = HashFile( vr, preview[0] ? HashFile( preview, 0xcbf29ce484222325ULL ) : 0xcbf29ce484222325ULL );
+		return PostCapture_Index;
+	case PostCapture_Index:
+	{
+		OGLockMutex( indexLock );
+		FILE * f = fopen( indexPath, "a" );
+		if( f )
+		{
+			fprintf( f, "%lld %s %lld %016llx %s\n", (long long)pc->request.scheduled, ScreenshotTypeName( pc->request.type ),
+				job->bytes, (unsigned long long)job->hash, vr );
+			fclose( f );
+		}
+		OGUnlockMutex( indexLock );
+		return -1;
+	}
+	}
+	return -1;
+}
 
-			ScreenshotHandle_t screenshot;
-			EVRScreenshotError ssERR;
-			ssERR = oScreenshots->TakeStereoScreenshot(&screenshot, screenshotpath, screenshotpathvr);
-			printf( "Screenshot (%d).\n", ssERR );
-			printf( "Current Directory: %s\n", screenshotpath);
+// Every screenshot we ask for gets a catalog record (see piss_catalog.h). It's started when
+// it's asked for and finished when it's been measured and hashed, or failed. ServiceCatalog()
+// writes them out.
+struct Catalog catalog;
 
-			sshour = hoursSinceEpoch;
+void CatalogRelativePath( char * out, size_t size, const char * path )
+{
+	size_t skip = strncmp( path, paths.root, paths.rootLength ) == 0 ? paths.rootLength : 0;
+	snprintf( out, size, "%s", path + skip );
+}
 
+// Returns the capture's ticket. If there's no pc SteamVR turned it down with error, and it's
+// done already.
+uint64_t CatalogAdd( const struct CaptureRequest * request, time_t now, const char * path, const char * pathvr, const struct PendingCapture * pc, int error )
+{
+	struct CatalogRecord r;
+	memset( &r, 0, sizeof( r ) );
+	r.magic = CATALOG_MAGIC;
+	r.version = CATALOG_VERSION;
+	r.size = sizeof( r );
+	r.time = now;
+	r.scheduled = request->scheduled;
+	r.type = request->type;
+	r.previewBytes = r.vrBytes = -1;
+	CatalogRelativePath( r.preview, sizeof( r.preview ), path );
+	CatalogRelativePath( r.vr, sizeof( r.vr ), pathvr );
+	if( pc )
+	{
+		r.handle = pc->handle;
+		r.flags = pc->context.flags;
+		memcpy( r.appKey, pc->context.appKey, sizeof( r.appKey ) );
+	}
+	else
+	{
+		r.flags = ( request->gated ? SidecarFlag_Gated : 0 ) | ( request->catchUp ? SidecarFlag_CatchUp : 0 ) | ( request->manual ? SidecarFlag_Manual : 0 );
+		uint32_t scene = oApplications->GetCurrentSceneProcessId();
+		if( scene )
+		{
+			oApplications->GetApplicationKeyByProcessId( scene, r.appKey, sizeof( r.appKey ) );
 		}
+	}
+	uint64_t ticket = CatalogReserve( &catalog, &r, MonotonicNow() );
+	if( !pc )
+	{
+		CatalogFinish( &catalog, ticket, error, NULL, NULL, -1, -1, 0 );
+	}
+	return ticket;
+}
 
-		Sleep( 500 ); // sleep for half a second (500ms)
-    }
+void FinishCatalog( const struct PendingCapture * pc, int error, long long previewBytes, long long vrBytes, uint64_t hash )
+{
+	if( !pc->catalogTicket )
+	{
+		return;
+	}
+	char preview[sizeof( catalog.slots[0].record.preview )];
+	char vr[sizeof( catalog.slots[0].record.vr )];
+	CatalogRelativePath( preview, sizeof( preview ), pc->previewFile );
+	CatalogRelativePath( vr, sizeof( vr ), pc->vrFile );
+	bool saved = pc->vrFile[0];
+	CatalogFinish( &catalog, pc->catalogTicket, error, saved ? preview : NULL, saved ? vr : NULL, previewBytes, vrBytes, hash );
+	CatalogRelease( &catalog, MonotonicNow() );
+}
 
-	return 0;
+// Back on the main thread once a step is done.
+void FinishPostCaptureJob( const struct WorkerJob * job )
+{
+	HistogramRecordSeconds( &jobWait[job->kind], job->started - job->queued );
+	HistogramRecordSeconds( &jobRun[job->kind], job->finished - job->started );
+	if( job->kind == PostCapture_Measure && job->bytes >= 0 )
+	{
+		int type = job->capture->request.type;
+		bytesWritten += job->bytes;
+		capturesMeasured++;
+		typeStats[type].bytes += job->bytes;
+		typeStats[type].measured++;
+	}
+	if( job->kind == PostCapture_Index )
+	{
+		imagesIndexed++;
+		FinishCatalog( job->capture, CatalogError_None, job->previewBytes, job->bytes - ( job->previewBytes > 0 ? job->previewBytes : 0 ), job->hash );
+	}
+	else if( ( job->kind == PostCapture_SaveMirror || job->kind == PostCapture_Measure ) && job->bytes < 0 )
+	{
+		FinishCatalog( job->capture, CatalogError_Missing, -1, -1, 0 );
+	}
+	if( job->last && job->capture )
+	{
+		HandleTableLetGo( job->capture );
+	}
+}
+
+void QueuePostCapture( struct PendingCapture * pc, bool ok )
+{
+	HistogramRecordSeconds( &typeStats[pc->request.type].writeTime, pc->resolved - pc->returned );
+	if( !ok )
+	{
+		return;
+	}
+	struct WorkerJob job;
+	memset( &job, 0, sizeof( job ) );
+	job.kind = PostCapture_Measure;
+	job.capture = pc;
+	if( pc->request.type == SCREENSHOT_TYPE_MIRROR )
+	{
+		job.kind = PostCapture_SaveMirror;
+		job.data = MirrorSlotFor( pc->handle );
+		if( !job.data )
+		{
+			FinishCatalog( pc, CatalogError_Missing, -1, -1, 0 );
+			return;
+		}
+	}
+	HandleTableHold( pc );
+	HistogramRecord( &queueDepth, WorkerQueueDepth( &workers.jobs ) );
+	if( !WorkerPoolSubmit( &workers, &job, FinishPostCaptureJob ) && workers.running )
+	{
+		jobsRunInline++;
+	}
+}
+
+// Sidecar records are collected here and written a batch at a time, by a worker, once a batch
+// fills up or the oldest record has waited sidecar_flush_seconds. There are two batches so one
+// can fill while the other's being written.
+struct SidecarBatch sidecarBatches[2];
+int sidecarCurrent;
+int sidecarFlushSeconds = 300;
+int sidecarsDropped;
+
+void FlushSidecar()
+{
+	struct SidecarBatch * batch = &sidecarBatches[sidecarCurrent];
+	if( !batch->count || atomic_load( &sidecarBatches[!sidecarCurrent].writing ) )
+	{
+		return;
+	}
+	struct WorkerJob job;
+	memset( &job, 0, sizeof( job ) );
+	job.kind = PostCapture_WriteSidecar;
+	job.data = batch;
+	atomic_store( &batch->writing, 1 );
+	sidecarCurrent = !sidecarCurrent;
+	if( !WorkerPoolSubmit( &workers, &job, FinishPostCaptureJob ) && workers.running )
+	{
+		jobsRunInline++;
+	}
+}
+
+void RecordSidecar( struct PendingCapture * pc, bool ok )
+{
+	if( !ok )
+	{
+		return;
+	}
+	struct SidecarBatch * batch = &sidecarBatches[sidecarCurrent];
+	if( batch->count == SIDECAR_BATCH )
+	{
+		// Both batches are full and the older one still hasn't been written.
+		sidecarsDropped++;
+		return;
+	}
+	if( !batch->count )
+	{
+		batch->started = MonotonicNow();
+	}
+	struct SidecarRecord * r = &batch->records[batch->count++];
+	*r = pc->context;
+	size_t skip = strncmp( pc->path, paths.root, paths.rootLength ) == 0 ? paths.rootLength : 0;
+	snprintf( r->name, sizeof( r->name ), "%s", pc->path + skip );
+	if( batch->count == SIDECAR_BATCH )
+	{
+		FlushSidecar();
+	}
+}
+
+void ServiceSidecar()
+{
+	struct SidecarBatch * batch = &sidecarBatches[sidecarCurrent];
+	if( batch->count && MonotonicNow() - batch->started >= sidecarFlushSeconds )
+	{
+		FlushSidecar();
+	}
+}
+
+void RecordCatalog( struct PendingCapture * pc, bool ok )
+{
+	if( !ok )
+	{
+		FinishCatalog( pc, CatalogError_NotSaved, -1, -1, 0 );
+	}
+}
+
+// Catalog batches go out the same way as the sidecar's, when they're full or have waited
+// sidecar_flush_seconds.
+void FlushCatalog()
+{
+	struct CatalogBatch * batch = CatalogTakeBatch( &catalog );
+	if( !batch )
+	{
+		return;
+	}
+	struct WorkerJob job;
+	memset( &job, 0, sizeof( job ) );
+	job.kind = PostCapture_WriteCatalog;
+	job.data = batch;
+	if( !WorkerPoolSubmit( &workers, &job, FinishPostCaptureJob ) && workers.running )
+	{
+		jobsRunInline++;
+	}
+}
+
+void ServiceCatalog()
+{
+	double now = MonotonicNow();
+	struct CatalogBatch * batch = &catalog.batches[catalog.current];
+	if( CatalogRelease( &catalog, now ) || ( batch->count && now - batch->started >= sidecarFlushSeconds ) )
+	{
+		FlushCatalog();
+	}
+}
+
+// Writes out every record left, finished or not, once the workers have stopped.
+void CloseCatalog()
+{
+	CatalogFinishAll( &catalog );
+	do
+	{
+		CatalogRelease( &catalog, MonotonicNow() );
+		CatalogWrite( &catalog.batches[catalog.current], catalogPath, catalogIndexPath );
+	} while( catalog.released < catalog.next );
+}
+
+// Saves everything in the replay buffer to its own folder next to the screenshots. The buffer
+// stops taking frames until a worker has written them all out.
+void SaveReplay()
+{
+	if( !replay.enabled || !replay.count || atomic_load( &replay.saving ) )
+	{
+		return;
+	}
+	time_t now = ClockNow();
+	struct WorkerJob job;
+	memset( &job, 0, sizeof( job ) );
+	job.kind = PostCapture_SaveReplay;
+	job.data = &replay;
+	char folder[64];
+	strftime( folder, sizeof( folder ), "replay_%Y-%m-%d_%H-%M-%S", gmtime( &now ) );
+	snprintf( replayFolder, sizeof( replayFolder ), "%s%s", screenshotsFolder, folder );
+	printf( "Saving the last %d replay frame(s) to %s\n", replay.count, replayFolder );
+
+	atomic_store( &replay.saving, 1 );
+	replaysSaved++;
+	HistogramRecord( &queueDepth, WorkerQueueDepth( &workers.jobs ) );
+	if( !WorkerPoolSubmit( &workers, &job, FinishPostCaptureJob ) && workers.running )
+	{
+		jobsRunInline++;
+	}
+}
+
+// Asks SteamVR which files it actually wrote for a screenshot, so nothing after this has to
+// guess at extensions or go looking. If it won't say, we fall back to what we asked for plus the
+// .png SteamVR normally adds.
+int filenameFallbacks;
+
+void ResolveCaptureFile( ScreenshotHandle_t handle, EVRScreenshotPropertyFilenames which, const char * asked, char * file, uint32_t size )
+{
+	EVRScreenshotError err = EVRScreenshotError_VRScreenshotError_None;
+	uint32_t length = oScreenshots->GetScreenshotPropertyFilename( handle, which, file, size, &err );
+	if( err != EVRScreenshotError_VRScreenshotError_None || length == 0 || length > size || !file[0] )
+	{
+		snprintf( file, size, "%s.png", asked );
+		filenameFallbacks++;
+	}
+}
+
+void ResolveCaptureFiles( struct PendingCapture * pc, bool ok )
+{
+	if( !ok )
+	{
+		return;
+	}
+	if( pc->request.type == SCREENSHOT_TYPE_MIRROR )
+	{
+		// We write these ourselves, there's only the one file.
+		pc->previewFile[0] = 0;
+		if( snprintf( pc->vrFile, sizeof( pc->vrFile ), "%s.bmp", pc->path ) >= (int)sizeof( pc->vrFile ) )
+		{
+			printf( "Mirror screenshot file name is too long, not saving %s\n", pc->path );
+			pc->vrFile[0] = 0;
+		}
+		return;
+	}
+	ResolveCaptureFile( pc->handle, EVRScreenshotPropertyFilenames_VRScreenshotPropertyFilenames_Preview, pc->path,
+		pc->previewFile, sizeof( pc->previewFile ) );
+	ResolveCaptureFile( pc->handle, EVRScreenshotPropertyFilenames_VRScreenshotPropertyFilenames_VR, pc->pathvr,
+		pc->vrFile, sizeof( pc->vrFile ) );
+}
+
+// With hook_screenshots on, SteamVR sends screenshots the user takes to us instead of taking
+// them itself. They go through the same pipeline as ours, and once the files are saved they're
+// handed back to SteamVR so it knows the screenshot happened.
+bool hookScreenshots;
+int hookedRequests;
+int hookedSubmitted;
+
+void SubmitHookedScreenshot( struct PendingCapture * pc, bool ok )
+{
+	if( !ok || !pc->request.manual )
+	{
+		return;
+	}
+	EVRScreenshotError err = oScreenshots->SubmitScreenshot( pc->request.hookHandle, EVRScreenshotType_VRScreenshotType_Stereo,
+		pc->previewFile, pc->vrFile );
+	if( err == EVRScreenshotError_VRScreenshotError_None )
+	{
+		hookedSubmitted++;
+	}
+	else
+	{
+		printf( "SteamVR wouldn't take screenshot %u back (%d).\n", pc->request.hookHandle, err );
+	}
+}
+
+void RetryFailedCapture( struct PendingCapture * pc, bool ok )
+{
+	if( !ok )
+	{
+		ScheduleRetry( &pc->request );
+	}
+}
+
+// If its folder has gone, the others might have too, so check them all again next time. SteamVR
+// fails screenshots for plenty of other reasons, like being busy, and those don't count.
+void ForgetFoldersOnFailure( struct PendingCapture * pc, bool ok )
+{
+	if( ok )
+	{
+		return;
+	}
+	char folder[_MAX_PATH];
+	snprintf( folder, sizeof( folder ), "%s", pc->path );
+	char * slash = strrchr( folder, PLATFORM_SEPARATOR );
+	if( slash )
+	{
+		*slash = 0;
+		if( !PlatformFolderExists( folder ) )
+		{
+			FoldersForget( &folders );
+		}
+	}
+}
+
+// Captures waiting their turn, oldest first. SteamVR only takes one screenshot at a time, so if
+// rules with different types come due together, or missed_captures all has a backlog to work
+// through, they queue up here. Catch-ups are also taken a few seconds apart so a long backlog
+// doesn't hog the compositor.
+#define MAX_QUEUED_CAPTURES 256
+#define CATCH_UP_SPACING 3
+struct CaptureRequest captureQueue[MAX_QUEUED_CAPTURES];
+int queuedCaptures;
+time_t lastCaptureTime;
+
+bool QueueCapture( time_t scheduled, int type, bool catchUp )
+{
+	if( queuedCaptures >= MAX_QUEUED_CAPTURES )
+	{
+		return false;
+	}
+	struct CaptureRequest * request = &captureQueue[queuedCaptures++];
+	memset( request, 0, sizeof( *request ) );
+	request->scheduled = scheduled;
+	request->type = type;
+	request->catchUp = catchUp;
+	return true;
+}
+
+// Puts a screenshot the user asked for at the front of the queue.
+bool QueueManualCapture( time_t now, ScreenshotHandle_t hookHandle )
+{
+	if( queuedCaptures >= MAX_QUEUED_CAPTURES )
+	{
+		return false;
+	}
+	memmove( captureQueue + 1, captureQueue, queuedCaptures * sizeof( captureQueue[0] ) );
+	queuedCaptures++;
+	struct CaptureRequest * request = &captureQueue[0];
+	memset( request, 0, sizeof( *request ) );
+	request->scheduled = now;
+	request->type = EVRScreenshotType_VRScreenshotType_Stereo;
+	request->manual = true;
+	request->hookHandle = hookHandle;
+	return true;
+}
+
+// Deals with everything OpenVR has sent us since last time. Returns false if we should quit.
+bool HandleVREvents()
+{
+	struct VREvent_t event;
+	while( oSystem->PollNextEvent( &event, sizeof( event ) ) )
+	{
+		switch( event.eventType )
+		{
+		case EVREventType_VREvent_Quit:
+			printf( "SteamVR is quitting.\n" );
+			oSystem->AcknowledgeQuit_Exiting();
+			return false;
+		case EVREventType_VREvent_RequestScreenshot:
+			// Only comes to us with hook_screenshots on.
+			printf( "Screenshot %u asked for.\n", event.data.screenshot.handle );
+			hookedRequests++;
+			if( !QueueManualCapture( ClockNow(), event.data.screenshot.handle ) )
+			{
+				printf( "Too many captures waiting, dropping it.\n" );
+			}
+			SaveReplay();
+			break;
+		case EVREventType_VREvent_ScreenshotTriggered:
+			// The user asked SteamVR for a screenshot, so keep what led up to it as well.
+			SaveReplay();
+			break;
+		case EVREventType_VREvent_ScreenshotTaken:
+		case EVREventType_VREvent_ScreenshotFailed:
+		{
+			bool ok = event.eventType == EVREventType_VREvent_ScreenshotTaken;
+			if( HandleTableResolve( &captures, event.data.screenshot.handle, ok, WallClockNow() ) )
+			{
+				printf( "Screenshot %u %s.\n", event.data.screenshot.handle, ok ? "saved" : "failed" );
+			}
+			break;
+		}
+		}
+	}
+
+	int expired = HandleTableExpire( &captures, WallClockNow(), PENDING_SCREENSHOT_TIMEOUT );
+	if( expired )
+	{
+		printf( "Never heard back about %d screenshot(s).\n", expired );
+	}
+	return true;
+}
+
+void PrintLatencyStats( FILE * f )
+{
+	fprintf( f, "Capture timings, %d failed while saving, %d retried ok, %d given up on:\n", failedCaptures, retriesSucceeded, retriesGivenUp );
+	HistogramPrint( f, "fire", &fireLatency );
+	HistogramPrint( f, "frame gate", &gateDelay );
+	HistogramPrint( f, "request", &requestTime );
+	HistogramPrint( f, "write", &writeTime );
+	HistogramPrint( f, "total", &totalLatency );
+	fprintf( f, "File names made in p50=%lluns p99=%lluns max=%lluns\n", (unsigned long long)HistogramPercentile( &pathTime, 0.5 ),
+		(unsigned long long)HistogramPercentile( &pathTime, 0.99 ), (unsigned long long)pathTime.max );
+	fprintf( f, "Folders made %lld times for %llu screenshots (%.3f per screenshot, was 2), forgotten %lld times\n", folders.made,
+		(unsigned long long)pathTime.total, pathTime.total ? (double)folders.made / pathTime.total : 0.0, folders.forgotten );
+	fprintf( f, "Screenshot errors:" );
+	for( int i = 0; i < MAX_SCREENSHOT_ERROR; i++ )
+	{
+		if( screenshotErrors[i] )
+		{
+			fprintf( f, " %d=%d", i, screenshotErrors[i] );
+		}
+	}
+	fprintf( f, " other=%d\n", screenshotErrors[MAX_SCREENSHOT_ERROR] );
+	double averageBytes = capturesMeasured ? bytesWritten / capturesMeasured : 0;
+	fprintf( f, "Captures taken=%d skipped (idle)=%d skipped (no game)=%d deferred=%d manual=%d/%d, about %.1f MB saved\n",
+		capturesTaken, capturesSkippedIdle, capturesSkippedNoScene, capturesDeferred, hookedSubmitted, hookedRequests,
+		( capturesSkippedIdle + capturesSkippedNoScene ) * averageBytes / ( 1024 * 1024 ) );
+	for( int gated = 0; gated < 2; gated++ )
+	{
+		struct FrameCost * c = &frameCost[gated];
+		fprintf( f, "%-8s captures=%-6d extra dropped/capture=%.2f extra reprojected/capture=%.2f\n",
+			gated ? "gated" : "ungated", c->captures,
+			c->captures ? c->extraDropped / c->captures : 0.0, c->captures ? c->extraReprojected / c->captures : 0.0 );
+	}
+	for( int type = 0; type < SCREENSHOT_TYPES; type++ )
+	{
+		struct TypeStats * t = &typeStats[type];
+		if( !t->cost.captures )
+		{
+			continue;
+		}
+		fprintf( f, "%-14s captures=%-6d extra dropped/capture=%.2f extra reprojected/capture=%.2f cpu p50=%.3fms save p50=%.0fms size=%.1f MB\n",
+			ScreenshotTypeName( type ), t->cost.captures, t->cost.extraDropped / t->cost.captures, t->cost.extraReprojected / t->cost.captures,
+			HistogramPercentile( &t->requestTime, 0.5 ) / 1000.0, HistogramPercentile( &t->writeTime, 0.5 ) / 1000.0,
+			t->measured ? t->bytes / t->measured / ( 1024 * 1024 ) : 0.0 );
+	}
+	if( mirrorGpuTime.total )
+	{
+		HistogramPrint( f, "mirror gpu", &mirrorGpuTime );
+	}
+	if( replay.enabled )
+	{
+		double covered = replay.count ? replay.frames[( replay.first + replay.count - 1 ) % REPLAY_MAX_FRAMES].time - replay.frames[replay.first].time : 0;
+		fprintf( f, "Replay: %d frames (%.1f s) in %.1f of %.1f MB, %.1f:1 compression at %.0f MB/s, %lld dropped, %d saved\n",
+			replay.count, covered, replay.used / ( 1024.0 * 1024.0 ), replay.arenaSize / ( 1024.0 * 1024.0 ),
+			replay.packedBytes ? replay.rawBytes / replay.packedBytes : 0.0,
+			replay.packSeconds > 0 ? replay.rawBytes / replay.packSeconds / ( 1024 * 1024 ) : 0.0, replay.framesDropped, replaysSaved );
+	}
+	fprintf( f, "Workers=%d, queue depth p50=%llu max=%llu, %d jobs run on the main thread, %d file names guessed, %d sidecars dropped:\n", workers.threadCount,
+		(unsigned long long)HistogramPercentile( &queueDepth, 0.5 ), (unsigned long long)queueDepth.max, jobsRunInline, filenameFallbacks, sidecarsDropped );
+	fprintf( f, "Catalog: %llu captures, %lld written before they were done, %lld dropped\n", (unsigned long long)( catalog.next ? catalog.next - 1 : 0 ),
+		catalog.unfinished, catalog.dropped );
+	for( int kind = 0; kind < POST_CAPTURE_JOBS; kind++ )
+	{
+		char name[32];
+		snprintf( name, sizeof( name ), "%s wait", postCaptureJobNames[kind] );
+		HistogramPrint( f, name, &jobWait[kind] );
+		snprintf( name, sizeof( name ), "%s run", postCaptureJobNames[kind] );
+		HistogramPrint( f, name, &jobRun[kind] );
+	}
+}
+
+// All of the capture rules, loaded from PISS.cfg. If there are none we fall back to the top of every hour.
+struct Schedule schedule;
+#define DEFAULT_SCHEDULE_RULE "every 60m"
+
+// What to do about captures that were missed because the machine was asleep or the clock moved.
+struct ClockWatch clockWatch = { .jumpTolerance = 2, .lateTolerance = 10 };
+int missedPolicy = MissedCapture_FireOnce;
+int missedCaptureLimit = 24;	// most catch-up screenshots we'll take in one go with missed_captures all
+int skippedCaptures;
+
+// Prints the capture timings and saves them to PISS-latency.txt next to the exe.
+void WriteLatencyStats()
+{
+	PrintLatencyStats( stdout );
+
+	FILE * f = fopen( statsPath, "w" );
+	if( f )
+	{
+		PrintLatencyStats( f );
+		fclose( f );
+	}
+}
+
+// Reads PISS.cfg from next to the exe. Each line is a setting name followed by its value,
+// anything after a # is ignored. It's fine for the file to not exist.
+void LoadConfig()
+{
+	FILE * f = fopen( configPath, "r" );
+	if( f )
+	{
+		char line[512];
+		int lineNumber = 0;
+		while( fgets( line, sizeof line, f ) )
+		{
+			lineNumber++;
+			char * comment = strchr( line, '#' );
+			if( comment )
+			{
+				*comment = 0;
+			}
+
+			char key[64];
+			int used;
+			if( sscanf( line, "%63s%n", key, &used ) != 1 )
+			{
+				continue;
+			}
+			const char * value = line + used;
+
+			if( strcmp( key, "schedule" ) == 0 )
+			{
+				struct ScheduleRule rule;
+				if( ScheduleParseRule( &rule, value ) || ( rule.type = ParseScreenshotType( rule.typeName ) ) < 0 ||
+					ScheduleAddRule( &schedule, &rule ) < 0 )
+				{
+					printf( "PISS.cfg:%d: bad schedule rule:%s", lineNumber, value );
+				}
+			}
+			else if( strcmp( key, "file_names" ) == 0 )
+			{
+				char template[256] = "";
+				sscanf( value, "%255s", template );
+				if( !PathsCompile( &paths, template ) )
+				{
+					printf( "PISS.cfg:%d: bad file_names template, keeping the default\n", lineNumber );
+				}
+			}
+			else if( strcmp( key, "missed_captures" ) == 0 )
+			{
+				char policy[16] = "";
+				sscanf( value, "%15s", policy );
+				if( strcmp( policy, "once" ) == 0 ) missedPolicy = MissedCapture_FireOnce;
+				else if( strcmp( policy, "all" ) == 0 ) missedPolicy = MissedCapture_FireAll;
+				else if( strcmp( policy, "skip" ) == 0 ) missedPolicy = MissedCapture_Skip;
+				else printf( "PISS.cfg:%d: missed_captures should be once, all or skip\n", lineNumber );
+			}
+			else if( strcmp( key, "missed_capture_limit" ) == 0 )
+			{
+				sscanf( value, "%d", &missedCaptureLimit );
+				if( missedCaptureLimit > MAX_QUEUED_CAPTURES ) missedCaptureLimit = MAX_QUEUED_CAPTURES;
+			}
+			else if( strcmp( key, "clock_jump_tolerance" ) == 0 )
+			{
+				sscanf( value, "%lf", &clockWatch.jumpTolerance );
+			}
+			else if( strcmp( key, "event_poll_ms" ) == 0 )
+			{
+				sscanf( value, "%d", &eventPollMs );
+				if( eventPollMs < 1 ) eventPollMs = 1;
+			}
+			else if( strcmp( key, "frame_gate_ms" ) == 0 )
+			{
+				sscanf( value, "%d", &frameGateMs );
+			}
+			else if( strcmp( key, "frame_gate_frames" ) == 0 )
+			{
+				sscanf( value, "%d", &frameGateFrames );
+				if( frameGateFrames < 1 ) frameGateFrames = 1;
+				if( frameGateFrames > FRAME_TIMING_HISTORY ) frameGateFrames = FRAME_TIMING_HISTORY;
+			}
+			else if( strcmp( key, "frame_gate_compare" ) == 0 )
+			{
+				int on = 0;
+				sscanf( value, "%d", &on );
+				frameGateCompare = on;
+			}
+			else if( strcmp( key, "when_idle" ) == 0 || strcmp( key, "when_no_game" ) == 0 )
+			{
+				int action = ParseIdleAction( value );
+				if( action < 0 ) printf( "PISS.cfg:%d: %s should be take, skip or defer\n", lineNumber, key );
+				else if( key[5] == 'i' ) whenIdle = action;
+				else whenNoScene = action;
+			}
+			else if( strcmp( key, "defer_limit" ) == 0 )
+			{
+				sscanf( value, "%d", &deferLimit );
+			}
+			else if( strcmp( key, "burst_count" ) == 0 )
+			{
+				sscanf( value, "%d", &burstCount );
+				if( burstCount < 1 ) burstCount = 1;
+			}
+			else if( strcmp( key, "burst_spacing_ms" ) == 0 )
+			{
+				sscanf( value, "%d", &burstSpacingMs );
+			}
+			else if( strcmp( key, "retry_initial_ms" ) == 0 )
+			{
+				sscanf( value, "%d", &retryInitialMs );
+				if( retryInitialMs < 1 ) retryInitialMs = 1;
+			}
+			else if( strcmp( key, "retry_deadline" ) == 0 )
+			{
+				sscanf( value, "%d", &retryDeadline );
+			}
+			else if( strcmp( key, "late_tolerance" ) == 0 )
+			{
+				sscanf( value, "%lf", &clockWatch.lateTolerance );
+			}
+			else if( strcmp( key, "replay_seconds" ) == 0 )
+			{
+				sscanf( value, "%lf", &replaySeconds );
+			}
+			else if( strcmp( key, "replay_fps" ) == 0 )
+			{
+				sscanf( value, "%d", &replayFps );
+				if( replayFps < 1 ) replayFps = 1;
+				if( replayFps > 90 ) replayFps = 90;
+			}
+			else if( strcmp( key, "replay_memory_mb" ) == 0 )
+			{
+				sscanf( value, "%d", &replayMemoryMb );
+				if( replayMemoryMb < 1 ) replayMemoryMb = 1;
+			}
+			else if( strcmp( key, "replay_scale" ) == 0 )
+			{
+				sscanf( value, "%d", &replayScale );
+				if( replayScale < 1 ) replayScale = 1;
+			}
+			else if( strcmp( key, "hook_screenshots" ) == 0 )
+			{
+				int hook = 0;
+				sscanf( value, "%d", &hook );
+				hookScreenshots = hook != 0;
+			}
+			else if( strcmp( key, "sidecar_flush_seconds" ) == 0 )
+			{
+				sscanf( value, "%d", &sidecarFlushSeconds );
+			}
+			else if( strcmp( key, "worker_threads" ) == 0 )
+			{
+				sscanf( value, "%d", &workerThreads );
+				if( workerThreads < 0 ) workerThreads = 0;
+				if( workerThreads > MAX_WORKERS ) workerThreads = MAX_WORKERS;
+			}
+			else
+			{
+				printf( "PISS.cfg:%d: unknown setting \"%s\"\n", lineNumber, key );
+			}
+		}
+		fclose( f );
+	}
+
+	if( schedule.ruleCount == 0 )
+	{
+		struct ScheduleRule rule;
+		ScheduleParseRule( &rule, DEFAULT_SCHEDULE_RULE );
+		rule.type = EVRScreenshotType_VRScreenshotType_Stereo;
+		ScheduleAddRule( &schedule, &rule );
+	}
+	printf( "Loaded %d schedule rule(s).\n", schedule.ruleCount );
+}
+
+// Notes down where everyone was and what was running, just after the screenshot was asked for
+// so it doesn't hold the request up.
+void FillSidecar( struct SidecarRecord * r, const struct PendingCapture * pc, time_t now, const Compositor_FrameTiming * timings, int timingCount )
+{
+	memset( r, 0, sizeof( *r ) );
+	r->magic = SIDECAR_MAGIC;
+	r->version = SIDECAR_VERSION;
+	r->size = sizeof( *r );
+	r->scheduled = pc->request.scheduled;
+	r->taken = now;
+	r->handle = pc->handle;
+	r->type = pc->request.type;
+	r->shot = pc->request.shot;
+	r->flags = ( pc->request.gated ? SidecarFlag_Gated : 0 ) | ( pc->late ? SidecarFlag_Late : 0 ) | ( pc->request.catchUp ? SidecarFlag_CatchUp : 0 ) |
+		( pc->request.manual ? SidecarFlag_Manual : 0 );
+	if( timingCount )
+	{
+		const Compositor_FrameTiming * last = &timings[timingCount - 1];
+		r->frameGpuMs = last->m_flTotalRenderGpuMs;
+		r->frameIntervalMs = last->m_flClientFrameIntervalMs;
+		r->compositorGpuMs = last->m_flCompositorRenderGpuMs;
+	}
+	r->droppedRate = pc->baseline.dropped;
+	r->reprojectedRate = pc->baseline.reprojected;
+
+	TrackedDeviceIndex_t devices[SIDECAR_DEVICES] = {
+		k_unTrackedDeviceIndex_Hmd,
+		oSystem->GetTrackedDeviceIndexForControllerRole( ETrackedControllerRole_TrackedControllerRole_LeftHand ),
+		oSystem->GetTrackedDeviceIndexForControllerRole( ETrackedControllerRole_TrackedControllerRole_RightHand ),
+	};
+	TrackedDevicePose_t poses[k_unMaxTrackedDeviceCount];
+	oSystem->GetDeviceToAbsoluteTrackingPose( ETrackingUniverseOrigin_TrackingUniverseStanding, 0, poses, k_unMaxTrackedDeviceCount );
+	for( int i = 0; i < SIDECAR_DEVICES; i++ )
+	{
+		if( devices[i] < k_unMaxTrackedDeviceCount )
+		{
+			SidecarPoseFrom( &r->poses[i], &poses[devices[i]] );
+		}
+	}
+
+	uint32_t scene = oApplications->GetCurrentSceneProcessId();
+	if( scene )
+	{
+		oApplications->GetApplicationKeyByProcessId( scene, r->appKey, sizeof( r->appKey ) );
+	}
+}
+
+// Makes the file names for a capture at now, both _MAX_PATH long. Later screenshots of a burst
+// get a number on the end of their name, and anything other than a stereo screenshot gets its
+// type on the end too. Returns false if the name is too long.
+bool CapturePaths( time_t now, const struct CaptureRequest * request, char * screenshotpath, char * screenshotpathvr )
+{
+	size_t length = PathsFormat( &paths, gmtime( &now ), screenshotpath, _MAX_PATH );
+	if( !length )
+	{
+		return false;
+	}
+	char typeName[24] = "";
+	if( request->type != EVRScreenshotType_VRScreenshotType_Stereo )
+	{
+		snprintf( typeName, sizeof typeName, "_%s", ScreenshotTypeName( request->type ) );
+	}
+	char shotNumber[16] = "";
+	if( request->shot > 0 )
+	{
+		snprintf( shotNumber, sizeof shotNumber, "_%d", request->shot + 1 );
+	}
+	// Everything we keep about a capture holds _MAX_PATH, and SteamVR puts "_VR" and an extension
+	// on the end, so the whole name has to fit with room for those.
+	const char * manual = request->manual ? "_manual" : "";
+	length += strlen( manual ) + strlen( typeName ) + strlen( shotNumber );
+	if( length + sizeof( "_VR.png" ) > _MAX_PATH )
+	{
+		return false;
+	}
+	strcat( screenshotpath, manual );
+	strcat( screenshotpath, typeName );
+	strcat( screenshotpath, shotNumber );
+	strcpy( screenshotpathvr, screenshotpath );
+	strcat( screenshotpathvr, "_VR" );
+	return true;
+}
+
+// Takes a screenshot now for a capture.
+EVRScreenshotError TakeScheduledScreenshot( time_t now, const struct CaptureRequest * request )
+{
+	double pathStart = OGGetAbsoluteTime();
+	char screenshotpath[_MAX_PATH];
+	char screenshotpathvr[_MAX_PATH];
+	if( !CapturePaths( now, request, screenshotpath, screenshotpathvr ) )
+	{
+		printf( "Screenshot file name is too long, check file_names in PISS.cfg.\n" );
+		return EVRScreenshotError_VRScreenshotError_RequestFailed;
+	}
+	if( !HandleTableHasRoom( &captures ) )
+	{
+		printf( "Every earlier screenshot is still being post-processed, not taking another yet.\n" );
+		return EVRScreenshotError_VRScreenshotError_RequestFailed;
+	}
+	HistogramRecord( &pathTime, (uint64_t)( ( OGGetAbsoluteTime() - pathStart ) * 1000000000.0 ) );
+	if( !MakeScreenshotFolders( screenshotpath ) )
+	{
+		printf( "Couldn't make the folders for %s\n", screenshotpath );
+	}
+
+	// Note how the compositor was doing just before, to see what the screenshot costs it.
+	Compositor_FrameTiming timings[FRAME_TIMING_HISTORY];
+	int timingCount = GetRecentFrameTimings( timings );
+	Compositor_CumulativeStats statsBefore;
+	oCompositor->GetCumulativeStats( &statsBefore, sizeof( statsBefore ) );
+
+	// Stereo screenshots are taken by the compositor itself and always work. The other types
+	// have to be supported by whatever app is running (or hooking screenshots).
+	ScreenshotHandle_t screenshot = k_unScreenshotHandleInvalid;
+	EVRScreenshotError ssERR;
+	double requested = WallClockNow();
+	if( request->type == EVRScreenshotType_VRScreenshotType_Stereo )
+	{
+		ssERR = oScreenshots->TakeStereoScreenshot(&screenshot, screenshotpath, screenshotpathvr);
+	}
+	else if( request->type == SCREENSHOT_TYPE_MIRROR )
+	{
+		ssERR = TakeMirrorScreenshot( &screenshot );
+	}
+	else
+	{
+		ssERR = oScreenshots->RequestScreenshot(&screenshot, request->type, screenshotpath, screenshotpathvr);
+	}
+	double returned = WallClockNow();
+	printf( "Screenshot %u %s (%d).\n", screenshot, ScreenshotTypeName( request->type ), ssERR );
+
+	bool late = request->catchUp || request->manual || difftime( now, request->scheduled ) > clockWatch.lateTolerance;
+	if( !late && request->shot == 0 && request->attempt == 0 )
+	{
+		HistogramRecordSeconds( &fireLatency, timerFiredAt - request->scheduled );
+	}
+	HistogramRecordSeconds( &requestTime, returned - requested );
+	if( request->type != SCREENSHOT_TYPE_MIRROR )
+	{
+		// Mirror captures add the time to take the pixels once they're back.
+		HistogramRecordSeconds( &typeStats[request->type].requestTime, returned - requested );
+	}
+	if( ssERR == EVRScreenshotError_VRScreenshotError_None )
+	{
+		struct PendingCapture * pc = HandleTableAdd( &captures, screenshot, returned );
+		pc->request = *request;
+		pc->noticed = timerFiredAt;
+		pc->returned = returned;
+		pc->late = late || request->shot > 0 || request->attempt > 0;
+		pc->statsBefore = statsBefore;
+		pc->baseline = FrameTimingsRates( timings, timingCount );
+		strcpy( pc->path, screenshotpath );
+		strcpy( pc->pathvr, screenshotpathvr );
+		FillSidecar( &pc->context, pc, now, timings, timingCount );
+		pc->catalogTicket = CatalogAdd( request, now, screenshotpath, screenshotpathvr, pc, ssERR );
+		capturesTaken++;
+	}
+	else
+	{
+		CatalogAdd( request, now, screenshotpath, screenshotpathvr, NULL, ssERR );
+	}
+	CountScreenshotError( ssERR );
+	printf( "Current Directory: %s\n", screenshotpath);
+
+	double hoursRunning = difftime( now, timerStart ) / 3600.0;
+	printf( "Fired %d s late, %d wakeups (%.2f per hour), %d of them for the timer and %d to poll events.\n", (int)( now - request->scheduled ),
+		timerWakeups + eventPolls, hoursRunning > 0 ? ( timerWakeups + eventPolls ) / hoursRunning : 0.0, timerWakeups, eventPolls );
+	lastCaptureTime = now;
+	return ssERR;
+}
+
+// Asks for one screenshot, and if SteamVR turns it down in a way worth retrying, sets that up.
+void AttemptShot( const struct CaptureRequest * request )
+{
+	bool retrying = retry.active && SameShot( &retry.request, request );
+	EVRScreenshotError err = TakeScheduledScreenshot( ClockNow(), request );
+	if( err == EVRScreenshotError_VRScreenshotError_None )
+	{
+		if( retrying )
+		{
+			retriesSucceeded++;
+		}
+		retry.active = false;
+	}
+	else if( ScreenshotErrorRetryable( err ) )
+	{
+		ScheduleRetry( request );
+	}
+	else
+	{
+		retry.active = false;
+	}
+}
+
+// Tries a turned down screenshot again once its backoff is up and SteamVR isn't busy with ours.
+void ServiceRetry()
+{
+	if( !retry.active || captures.count || WallClockNow() < retry.nextAttempt )
+	{
+		return;
+	}
+	struct CaptureRequest request = retry.request;
+	AttemptShot( &request );
+}
+
+// Takes the first screenshot of a capture, and sets up the rest of the burst if there is one.
+void LaunchCapture( const struct CaptureRequest * request )
+{
+	if( burst.active )
+	{
+		printf( "Dropping the last %d screenshot(s) of the previous burst.\n", burstCount - burst.request.shot );
+		burst.active = false;
+	}
+	if( retry.active )
+	{
+		printf( "Giving up on the last screenshot, there's a new one to take.\n" );
+		retry.active = false;
+		retriesGivenUp++;
+	}
+	AttemptShot( request );
+	if( burstCount > 1 && !request->manual )
+	{
+		burst.active = true;
+		burst.request = *request;
+		burst.request.shot = 1;
+		burst.lastRequest = WallClockNow();
+	}
+}
+
+// Takes the next screenshot of a burst once the previous one is done and the spacing has passed.
+void ServiceBurst()
+{
+	if( !burst.active || captures.count || retry.active )
+	{
+		return;
+	}
+	double sinceLast = ( WallClockNow() - burst.lastRequest ) * 1000.0;
+	if( sinceLast < burstSpacingMs )
+	{
+		return;
+	}
+	// If this one gets turned down the retry takes care of it, and the burst waits for that.
+	AttemptShot( &burst.request );
+	burst.lastRequest = WallClockNow();
+	if( ++burst.request.shot >= burstCount )
+	{
+		burst.active = false;
+	}
+}
+
+// Goes ahead with the capture waiting on the frame gate once frame timings have settled, or
+// once we've waited as long as we're allowed to.
+void ServiceFrameGate()
+{
+	if( !frameGate.active )
+	{
+		return;
+	}
+	double waited = WallClockNow() - frameGate.since;
+	if( FramesAreStable() || waited * 1000.0 >= frameGateMs )
+	{
+		frameGate.active = false;
+		HistogramRecordSeconds( &gateDelay, waited );
+		LaunchCapture( &frameGate.request );
+	}
+}
+
+// Starts a capture, either straight away or through the frame gate.
+void BeginCapture( const struct CaptureRequest * request )
+{
+	if( frameGate.active )
+	{
+		// Two at once shouldn't happen, but if it does don't hold up the first one any longer.
+		frameGate.active = false;
+		LaunchCapture( &frameGate.request );
+	}
+
+	struct CaptureRequest gatedRequest = *request;
+	gatedRequest.gated = !request->manual && frameGateMs > 0 && !( frameGateCompare && ( capturesStarted & 1 ) );
+	capturesStarted++;
+	if( !gatedRequest.gated )
+	{
+		HistogramRecordSeconds( &gateDelay, 0 );
+		LaunchCapture( &gatedRequest );
+		return;
+	}
+	frameGate.active = true;
+	frameGate.request = gatedRequest;
+	frameGate.since = WallClockNow();
+	ServiceFrameGate();
+}
+
+// What the settings say to do about something blocking a capture.
+int IdleActionFor( int blocker )
+{
+	switch( blocker )
+	{
+	case CaptureBlocker_Idle: return whenIdle;
+	case CaptureBlocker_NoScene: return whenNoScene;
+	}
+	return IdleAction_Take;
+}
+
+void CountSkipped( int blocker )
+{
+	if( blocker == CaptureBlocker_NoScene )
+	{
+		capturesSkippedNoScene++;
+	}
+	else
+	{
+		capturesSkippedIdle++;
+	}
+}
+
+// What a --simulate run took, and the folders its names would have needed.
+struct SimulatedLog simulatedCaptures;
+struct Folders simulatedFolders;
+
+bool SimulatedMakeFolder( const char * path )
+{
+	return true;
+}
+
+// Stands in for the whole capture under --simulate. It still makes the file name, so the
+// folder cache gets to see every month rollover.
+void SimulateCapture( time_t now, const struct CaptureRequest * request )
+{
+	char screenshotpath[_MAX_PATH];
+	if( PathsFormat( &paths, gmtime( &now ), screenshotpath, sizeof screenshotpath ) )
+	{
+		FoldersMake( &simulatedFolders, screenshotpath, paths.rootLength, SimulatedMakeFolder );
+	}
+	if( !SimulatedLogAdd( &simulatedCaptures, request->scheduled, request->type ) )
+	{
+		printf( "Error!!!! Out of memory for simulated captures\n" );
+		exit( 1 );
+	}
+	capturesTaken++;
+	lastCaptureTime = now;
+}
+
+// Checks whether anyone's in VR before going ahead with a capture.
+void StartCapture( time_t now, const struct CaptureRequest * request )
+{
+	if( virtualClock.on )
+	{
+		SimulateCapture( now, request );
+		return;
+	}
+	if( request->manual )
+	{
+		// Someone just asked for this one, so they're obviously there.
+		BeginCapture( request );
+		return;
+	}
+	if( deferredCapture.active )
+	{
+		// A newer capture replaces one that's still waiting for someone to come back.
+		deferredCapture.active = false;
+		CountSkipped( deferredCapture.blocker );
+	}
+
+	const char * why = "";
+	int blocker = WhyNotCapture( &why );
+	switch( IdleActionFor( blocker ) )
+	{
+	case IdleAction_Take:
+		BeginCapture( request );
+		break;
+	case IdleAction_Skip:
+		printf( "Skipping screenshot, %s.\n", why );
+		CountSkipped( blocker );
+		break;
+	case IdleAction_Defer:
+		printf( "Holding screenshot back, %s.\n", why );
+		capturesDeferred++;
+		deferredCapture.active = true;
+		deferredCapture.request = *request;
+		deferredCapture.since = now;
+		deferredCapture.blocker = blocker;
+		break;
+	}
+}
+
+// Goes ahead with a deferred capture once someone's back, or gives up on it after defer_limit.
+void ServiceDeferredCapture()
+{
+	if( !deferredCapture.active )
+	{
+		return;
+	}
+	time_t now = ClockNow();
+	const char * why = "";
+	int blocker = WhyNotCapture( &why );
+	if( IdleActionFor( blocker ) == IdleAction_Take )
+	{
+		deferredCapture.active = false;
+		BeginCapture( &deferredCapture.request );
+	}
+	else if( difftime( now, deferredCapture.since ) >= deferLimit )
+	{
+		printf( "Gave up on screenshot, %s.\n", why );
+		deferredCapture.active = false;
+		CountSkipped( blocker );
+	}
+}
+
+// True while a capture is anywhere between the frame gate and SteamVR saying it's done.
+bool CapturePipelineBusy()
+{
+	return frameGate.active || burst.active || retry.active || captures.count;
+}
+
+// How long the loop can wait on the timer before it has to look at something else. A screenshot
+// being written or waiting on the frame gate is checked on every few milliseconds, a retry or the
+// next shot of a burst is waited for exactly, and otherwise it's just SteamVR's events.
+int EventPollWait()
+{
+	if( captures.count || frameGate.active )
+	{
+		return BUSY_EVENT_POLL_MS;
+	}
+	double waitMs = eventPollMs;
+	double now = WallClockNow();
+	if( retry.active && ( retry.nextAttempt - now ) * 1000.0 < waitMs )
+	{
+		waitMs = ( retry.nextAttempt - now ) * 1000.0;
+	}
+	if( burst.active && burstSpacingMs - ( now - burst.lastRequest ) * 1000.0 < waitMs )
+	{
+		waitMs = burstSpacingMs - ( now - burst.lastRequest ) * 1000.0;
+	}
+	if( replay.enabled && ReplayIntervalMs() < waitMs )
+	{
+		waitMs = ReplayIntervalMs();
+	}
+	return waitMs < 1 ? 1 : (int)( waitMs + 0.999 );
+}
+
+// Takes care of everything in the schedule that's come due by now. Rules of the same type that
+// land on the same second share a screenshot. Anything we're more than late_tolerance late for
+// was missed, and gets dealt with by the missed_captures policy.
+void ServiceSchedule( time_t now )
+{
+	time_t onTime[SCREENSHOT_TYPES] = { 0 };
+	time_t missedLast[SCREENSHOT_TYPES] = { 0 };
+	time_t missedFirst = 0;
+	time_t lastQueued[SCREENSHOT_TYPES] = { 0 };
+	int missed = 0;
+	int dropped = 0;
+	time_t when;
+
+	while( SchedulePeek( &schedule ) && SchedulePeek( &schedule ) <= now )
+	{
+		int type = schedule.rules[SchedulePop( &schedule, &when )].type;
+
+		if( difftime( now, when ) <= clockWatch.lateTolerance )
+		{
+			onTime[type] = when;
+			continue;
+		}
+
+		if( missedLast[type] == when )
+		{
+			continue;
+		}
+		missed++;
+		if( !missedFirst || when < missedFirst )
+		{
+			missedFirst = when;
+		}
+		missedLast[type] = when;
+		if( missedPolicy == MissedCapture_FireAll && lastQueued[type] != when )
+		{
+			lastQueued[type] = when;
+			if( missed > missedCaptureLimit || !QueueCapture( when, type, true ) )
+			{
+				dropped++;
+			}
+		}
+	}
+
+	if( missed )
+	{
+		printf( "Missed %d capture(s), the oldest %d s ago.\n", missed, (int)( now - missedFirst ) );
+		switch( missedPolicy )
+		{
+		case MissedCapture_Skip:
+			skippedCaptures += missed;
+			break;
+		case MissedCapture_FireOnce:
+			// If something of the same type is due right now that screenshot covers them.
+			for( int type = 0; type < SCREENSHOT_TYPES; type++ )
+			{
+				if( missedLast[type] && !onTime[type] )
+				{
+					QueueCapture( missedLast[type], type, false );
+				}
+			}
+			break;
+		case MissedCapture_FireAll:
+			if( dropped )
+			{
+				printf( "Only catching up the first %d, %d dropped.\n", missedCaptureLimit, dropped );
+				skippedCaptures += dropped;
+			}
+			break;
+		}
+	}
+
+	for( int type = 0; type < SCREENSHOT_TYPES; type++ )
+	{
+		if( onTime[type] )
+		{
+			QueueCapture( onTime[type], type, false );
+		}
+	}
+}
+
+// Starts the next queued capture once the last one is out of the way. Catch-ups wait until
+// CATCH_UP_SPACING after the last screenshot.
+void ServiceCaptureQueue( time_t now )
+{
+	if( !queuedCaptures || CapturePipelineBusy() )
+	{
+		return;
+	}
+	if( captureQueue[0].catchUp && difftime( now, lastCaptureTime ) < CATCH_UP_SPACING )
+	{
+		return;
+	}
+	struct CaptureRequest request = captureQueue[0];
+	queuedCaptures--;
+	memmove( captureQueue, captureQueue + 1, queuedCaptures * sizeof( captureQueue[0] ) );
+	StartCapture( now, &request );
+}
+
+// Sets up a hidden GL window for the mirror texture, if any rule wants mirror captures.
+void MirrorCaptureInit()
+{
+	bool wanted = replaySeconds > 0;
+	for( int i = 0; i < schedule.ruleCount; i++ )
+	{
+		wanted |= schedule.rules[i].type == SCREENSHOT_TYPE_MIRROR;
+	}
+	if( !wanted )
+	{
+		return;
+	}
+	CNFGSetup( "PISS", 64, 64 );
+	// The window is only there for a GL context, nobody needs to see it.
+#if defined( _WIN32 )
+	ShowWindow( CNFGlsHWND, SW_HIDE );
+#else
+	XUnmapWindow( CNFGDisplay, CNFGWindow );
+#endif
+	if( !MirrorStart( &mirror, oCompositor ) )
+	{
+		printf( "Error!!!! Could not get the compositor mirror texture, mirror captures won't work\n" );
+		return;
+	}
+	if( replaySeconds > 0 && !ReplayStart( &replay, replaySeconds, (size_t)replayMemoryMb * 1024 * 1024, replayScale ) )
+	{
+		printf( "Error!!!! Could not allocate %d MB for the replay buffer\n", replayMemoryMb );
+	}
+	nextReplayFrame = OGGetAbsoluteTime();
+}
+
+// How long --simulate runs for, and where it started.
+int simulatedDays;
+time_t simulatedStart;
+
+// PISS --simulate [days] [YYYY-MM-DD] runs the schedule in PISS.cfg against the virtual clock,
+// by default for 365 days from local midnight at the start of this year. Try it with TZ set to
+// somewhere with DST.
+bool SimulateStart( int argc, char ** argv )
+{
+	struct tm start;
+	time_t now = time(NULL);
+	ScheduleLocalTime( now, &start );
+	start.tm_mon = 0;
+	start.tm_mday = 1;
+	simulatedDays = 365;
+	if( argc > 0 && ( simulatedDays = atoi( argv[0] ) ) <= 0 )
+	{
+		printf( "Error!!!! --simulate wants a number of days, not \"%s\"\n", argv[0] );
+		return false;
+	}
+	if( argc > 1 )
+	{
+		if( sscanf( argv[1], "%d-%d-%d", &start.tm_year, &start.tm_mon, &start.tm_mday ) != 3 )
+		{
+			printf( "Error!!!! --simulate wants the start date as YYYY-MM-DD, not \"%s\"\n", argv[1] );
+			return false;
+		}
+		start.tm_year -= 1900;
+		start.tm_mon -= 1;
+	}
+	simulatedStart = ScheduleLocalDayTime( &start, 0, 0 );
+	virtualClock.now = simulatedStart;
+	virtualClock.end = ScheduleLocalDayTime( &start, simulatedDays, 0 );
+	virtualClock.on = true;
+	return true;
+}
+
+// Checks what the simulation took against what it should have. Returns 0 if they match.
+int SimulateReport( double cpuSeconds )
+{
+	struct SimulatedLog expected = { 0 };
+	struct SimulatedResult result;
+	if( !SimulateExpected( &schedule, simulatedStart, (time_t)virtualClock.end, &expected ) )
+	{
+		printf( "Error!!!! Out of memory for expected captures\n" );
+		return 1;
+	}
+	SimulateCompare( &expected, &simulatedCaptures, &result );
+	SimulatedLogFree( &expected );
+
+	char from[32];
+	struct tm lt;
+	ScheduleLocalTime( simulatedStart, &lt );
+	strftime( from, sizeof( from ), "%Y-%m-%d", &lt );
+	printf( "Simulated %d days from %s in %.2f s of CPU (%.3f ms per day).\n", simulatedDays, from, cpuSeconds, cpuSeconds * 1000.0 / simulatedDays );
+	printf( "%lld captures of %lld due, %lld missed, %lld taken twice, %lld not due.\n", result.taken, result.expected,
+		result.missed, result.duplicates, result.unexpected );
+	printf( "%d wakeups (%.2f per hour), %d of them for the timer and %d to poll events, folders made %lld times.\n",
+		timerWakeups + eventPolls, ( timerWakeups + eventPolls ) / ( simulatedDays * 24.0 ), timerWakeups, eventPolls, simulatedFolders.made );
+	return result.missed || result.duplicates || result.unexpected ? 1 : 0;
+}
+
+// PISS --bench [seconds] [interval] runs the whole capture pipeline for real, a screenshot every
+// interval (2s by default) for 60 seconds, and then writes how it did to PISS-bench.json. It's
+// meant to be run against fake_openvr.c, so changes to the hot path can be compared run to run.
+// Everything in PISS.cfg except the schedule still applies.
+#define BENCH_POST_IMAGES 256
+#define BENCH_PATH_NAMES 100000
+struct Bench
+{
+	bool on;
+	int seconds;
+	struct ScheduleRule rule;
+	bool running;
+	double end;					// monotonic
+	bool steady;				// the first capture is on disk, everything after counts
+	double steadyStart;
+	double steadyCpu;
+	int steadyWakeups;
+	int steadyPolls;
+	double stopped;
+	double stoppedCpu;
+	int stoppedWakeups;
+	int stoppedPolls;
+	bool haveSample;
+	struct PendingCapture sample;	// the last screenshot saved, for measuring post-processing on its own
+	int postWorkers;
+	int postImages;
+	double postSeconds;
+	double pathNanoseconds;		// per capture, from BenchPathBuilding()
+};
+struct Bench bench;
+
+bool BenchStart( int argc, char ** argv )
+{
+	char rule[64];
+	bench.seconds = argc > 0 ? atoi( argv[0] ) : 60;
+	snprintf( rule, sizeof( rule ), "every %s", argc > 1 ? argv[1] : "2s" );
+	if( bench.seconds <= 0 || ScheduleParseRule( &bench.rule, rule ) )
+	{
+		printf( "Error!!!! Usage: PISS --bench [seconds] [interval, like 2s]\n" );
+		return false;
+	}
+	bench.rule.type = EVRScreenshotType_VRScreenshotType_Stereo;
+	bench.on = true;
+	return true;
+}
+
+void BenchKeepSample( struct PendingCapture * pc, bool ok )
+{
+	if( ok && pc->request.type != SCREENSHOT_TYPE_MIRROR )
+	{
+		bench.sample = *pc;
+		bench.sample.holds = 0;
+		bench.haveSample = true;
+	}
+}
+
+// The bench's captures, and the same image put through post-processing over and over, would
+// otherwise end up in the real index, catalog and sidecar. They go in files of their own instead,
+// started afresh each run so runs can be compared.
+void BenchUseScratchFiles()
+{
+	sidecarPath = benchSidecarPath;
+	indexPath = benchIndexPath;
+	catalogPath = benchCatalogPath;
+	catalogIndexPath = benchCatalogIndexPath;
+	remove( sidecarPath );
+	remove( indexPath );
+	remove( catalogPath );
+	remove( catalogIndexPath );
+}
+
+// Notes when the steady state starts, and where it ends. Returns false once it's time to stop.
+bool ServiceBench()
+{
+	double now = MonotonicNow();
+	if( !bench.running )
+	{
+		bench.running = true;
+		bench.end = now + bench.seconds;
+	}
+	if( !bench.steady && totalLatency.total )
+	{
+		bench.steady = true;
+		bench.steadyStart = now;
+		bench.steadyCpu = PlatformCpuSeconds();
+		bench.steadyWakeups = timerWakeups;
+		bench.steadyPolls = eventPolls;
+	}
+	if( now < bench.end )
+	{
+		return true;
+	}
+	bench.stopped = now;
+	bench.stoppedCpu = PlatformCpuSeconds();
+	bench.stoppedWakeups = timerWakeups;
+	bench.stoppedPolls = eventPolls;
+	return false;
+}
+
+// Lets whatever capture is still going when the bench ends finish, so it's indexed and cataloged
+// like the rest. Nothing new is started, and none of this counts towards the results.
+#define BENCH_DRAIN_SECONDS 10
+void BenchFinishCaptures()
+{
+	double giveUp = MonotonicNow() + BENCH_DRAIN_SECONDS;
+	while( CapturePipelineBusy() && MonotonicNow() < giveUp )
+	{
+		PlatformSleepMs( BUSY_EVENT_POLL_MS );
+		if( !HandleVREvents() )
+		{
+			break;
+		}
+		ServiceMirror();
+		ServiceFrameGate();
+		ServiceRetry();
+		ServiceBurst();
+		WorkerPoolDrain( &workers, FinishPostCaptureJob );
+	}
+	if( CapturePipelineBusy() )
+	{
+		printf( "Gave up waiting on the last capture after %d s.\n", BENCH_DRAIN_SECONDS );
+	}
+}
+
+// Puts the last screenshot through measure, hash and index BENCH_POST_IMAGES times with every
+// worker kept busy, to see how many images a second post-processing can keep up with.
+void BenchPostProcessing()
+{
+	if( !bench.haveSample )
+	{
+		return;
+	}
+	while( atomic_load( &workers.pending ) )
+	{
+		WorkerPoolDrain( &workers, FinishPostCaptureJob );
+		OGUSleep( 1000 );
+	}
+	WorkerPoolDrain( &workers, FinishPostCaptureJob );
+
+	bench.sample.catalogTicket = 0;	// it already has its record
+	int before = imagesIndexed;
+	int submitted = 0;
+	double start = OGGetAbsoluteTime();
+	while( submitted < BENCH_POST_IMAGES || atomic_load( &workers.pending ) )
+	{
+		// Enough queued that no worker ever waits, but not so many that jobs end up back on this thread.
+		while( submitted < BENCH_POST_IMAGES && WorkerQueueDepth( &workers.jobs ) < WORKER_QUEUE_SIZE / 2 )
+		{
+			struct WorkerJob job;
+			memset( &job, 0, sizeof( job ) );
+			job.kind = PostCapture_Measure;
+			job.capture = &bench.sample;
+			HandleTableHold( &bench.sample );
+			WorkerPoolSubmit( &workers, &job, FinishPostCaptureJob );
+			submitted++;
+		}
+		if( !WorkerPoolDrain( &workers, FinishPostCaptureJob ) )
+		{
+			OGUSleep( 100 );
+		}
+	}
+	WorkerPoolDrain( &workers, FinishPostCaptureJob );
+	bench.postSeconds = OGGetAbsoluteTime() - start;
+	bench.postWorkers = workers.threadCount;
+	bench.postImages = imagesIndexed - before;
+}
+
+// Makes BENCH_PATH_NAMES sets of file names back to back, a second apart and with every kind
+// of suffix, to time just that. A single capture's time in pathTime is mostly timer noise.
+void BenchPathBuilding()
+{
+	char path[_MAX_PATH], pathvr[_MAX_PATH];
+	struct CaptureRequest request;
+	memset( &request, 0, sizeof( request ) );
+	time_t now = time( NULL );
+	size_t made = 0;
+	double start = OGGetAbsoluteTime();
+	for( int i = 0; i < BENCH_PATH_NAMES; i++ )
+	{
+		request.type = i % 4 ? EVRScreenshotType_VRScreenshotType_Stereo : EVRScreenshotType_VRScreenshotType_Mono;
+		request.shot = i % 3;
+		request.manual = i % 7 == 0;
+		// Adding up the lengths keeps the compiler from skipping any of it.
+		made += CapturePaths( now + i, &request, path, pathvr ) ? strlen( pathvr ) : 0;
+	}
+	bench.pathNanoseconds = made ? ( OGGetAbsoluteTime() - start ) * 1000000000.0 / BENCH_PATH_NAMES : 0;
+}
+
+void PrintBench( FILE * f )
+{
+	double steadySeconds = bench.steady ? bench.stopped - bench.steadyStart : 0;
+	double hours = steadySeconds / 3600.0;
+	int wakeups = bench.stoppedWakeups - bench.steadyWakeups;
+	int polls = bench.stoppedPolls - bench.steadyPolls;
+	fprintf( f, "{\n" );
+	fprintf( f, "  \"seconds\": %d,\n  \"interval_s\": %d,\n  \"steady_seconds\": %.3f,\n", bench.seconds, bench.rule.periodSeconds, steadySeconds );
+	fprintf( f, "  \"captures\": %d,\n  \"saved\": %llu,\n  \"failed\": %d,\n  \"retried\": %d,\n", capturesTaken,
+		(unsigned long long)totalLatency.total, failedCaptures, retriesSucceeded + retriesGivenUp );
+	fprintf( f, "  " ); HistogramPrintJson( f, "fire", &fireLatency ); fprintf( f, ",\n" );
+	fprintf( f, "  " ); HistogramPrintJson( f, "request", &requestTime ); fprintf( f, ",\n" );
+	fprintf( f, "  " ); HistogramPrintJson( f, "write", &writeTime ); fprintf( f, ",\n" );
+	fprintf( f, "  " ); HistogramPrintJson( f, "file_on_disk", &totalLatency ); fprintf( f, ",\n" );
+	fprintf( f, "  \"post_processing_workers\": %d,\n  \"post_processing_images\": %d,\n  \"post_processing_images_per_s\": %.1f,\n",
+		bench.postWorkers, bench.postImages, bench.postSeconds > 0 ? bench.postImages / bench.postSeconds : 0.0 );
+	fprintf( f, "  \"path_build_ns\": %.1f,\n", bench.pathNanoseconds );
+	fprintf( f, "  \"timer_wakeups_per_hour\": %.1f,\n  \"wakeups_per_hour\": %.1f,\n", hours > 0 ? wakeups / hours : 0.0,
+		hours > 0 ? ( wakeups + polls ) / hours : 0.0 );
+	fprintf( f, "  \"cpu_percent\": %.3f,\n", steadySeconds > 0 ? ( bench.stoppedCpu - bench.steadyCpu ) * 100.0 / steadySeconds : 0.0 );
+	fprintf( f, "  \"peak_rss_mb\": %.1f\n", PlatformPeakMemory() / ( 1024.0 * 1024.0 ) );
+	fprintf( f, "}\n" );
+}
+
+// Prints the results and saves them to PISS-bench.json. Returns 0 if anything was saved at all.
+int BenchReport()
+{
+	PrintBench( stdout );
+	FILE * f = fopen( benchPath, "w" );
+	if( f )
+	{
+		PrintBench( f );
+		fclose( f );
+	}
+	return totalLatency.total ? 0 : 1;
+}
+
+// PISS --find [from] [to] [app <key>] [type <name>] lists the captures in the catalog. It
+// doesn't need SteamVR, and it's fine to run while PISS is. from and to are local times as
+// YYYY-MM-DD or "YYYY-MM-DD HH:MM", or - for no limit, and a to with no time takes in that day.
+bool ParseFindTime( const char * text, bool to, int64_t * out )
+{
+	if( strcmp( text, "-" ) == 0 )
+	{
+		*out = 0;
+		return true;
+	}
+	struct tm day;
+	memset( &day, 0, sizeof( day ) );
+	int hour = 0, minute = 0;
+	int got = sscanf( text, "%d-%d-%d%*1[ T]%d:%d", &day.tm_year, &day.tm_mon, &day.tm_mday, &hour, &minute );
+	if( got != 3 && got != 5 )
+	{
+		return false;
+	}
+	day.tm_year -= 1900;
+	day.tm_mon -= 1;
+	*out = ScheduleLocalDayTime( &day, got == 3 && to ? 1 : 0, hour * 3600 + minute * 60 );
+	return true;
+}
+
+void PrintFoundCapture( const struct CatalogRecord * r )
+{
+	char when[32];
+	struct tm lt;
+	ScheduleLocalTime( (time_t)r->time, &lt );
+	strftime( when, sizeof( when ), "%Y-%m-%d %H:%M:%S", &lt );
+	char error[16] = "ok";
+	if( r->error )
+	{
+		snprintf( error, sizeof( error ), "error %d", r->error );
+	}
+	printf( "%s  %-14s %-10s %-30.*s %.*s\n", when, ScreenshotTypeName( r->type ), error,
+		(int)sizeof( r->appKey ), r->appKey[0] ? r->appKey : "-", (int)sizeof( r->vr ), r->vr );
+}
+
+int FindCaptures( int argc, char ** argv )
+{
+	struct CatalogQuery q = { 0, 0, NULL, -1 };
+	int times = 0;
+	for( int i = 0; i < argc; i++ )
+	{
+		if( strcmp( argv[i], "app" ) == 0 && i + 1 < argc )
+		{
+			q.app = argv[++i];
+		}
+		else if( strcmp( argv[i], "type" ) == 0 && i + 1 < argc )
+		{
+			if( ( q.type = ParseScreenshotType( argv[++i] ) ) < 0 )
+			{
+				printf( "Error!!!! --find doesn't know the screenshot type \"%s\"\n", argv[i] );
+				return -7;
+			}
+		}
+		else if( times < 2 && ParseFindTime( argv[i], times == 1, times ? &q.to : &q.from ) )
+		{
+			times++;
+		}
+		else
+		{
+			printf( "Error!!!! --find wants [from] [to] [app <key>] [type <name>], not \"%s\"\n", argv[i] );
+			return -7;
+		}
+	}
+
+	PathsInit();
+	struct CatalogReader reader;
+	CatalogReaderOpen( &reader, catalogPath, catalogIndexPath );
+	uint64_t at = CatalogQueryStart( &reader, &q );
+	const struct CatalogRecord * r;
+	long long found = 0;
+	while( ( r = CatalogQueryNext( &reader, &q, &at ) ) )
+	{
+		PrintFoundCapture( r );
+		found++;
+	}
+	printf( "%lld of %llu captures.\n", found, (unsigned long long)reader.count );
+	CatalogReaderClose( &reader );
+	return 0;
+}
+
+// PISS --bench-catalog [records] times the catalog reader against a made up catalog, a million
+// records by default, in Screenshots\catalog-bench.bin: opening it, finding a time, and range
+// queries with and without filters, each checked against reading every record. Then it keeps
+// querying while another thread adds to the end, the way PISS does to a reader, and checks
+// PISS starting again with the clock behind the catalog. Returns 0 if every answer was right.
+#define CATALOG_BENCH_APPS 16
+#define CATALOG_BENCH_LOOKUPS 100000
+#define CATALOG_BENCH_QUERIES 10000
+#define CATALOG_BENCH_CHECKED 20
+#define CATALOG_BENCH_APPENDS 20000
+struct CatalogBench
+{
+	uint64_t seed;				// the writer's, so every run makes the same catalog
+	int64_t time;				// of the last record made
+	long long made;
+	struct CatalogBatch batch;
+	struct Catalog restarted;	// PISS starting again on the same catalog
+	atomic_int appending;
+	atomic_int writeFailed;
+	long long checked;
+	long long wrong;
+};
+struct CatalogBench catalogBench;
+
+// xorshift64
+uint64_t CatalogBenchRandom( uint64_t * seed )
+{
+	uint64_t x = *seed;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *seed = x;
+}
+
+void CatalogBenchRecord( struct CatalogRecord * r )
+{
+	const int types[] = { EVRScreenshotType_VRScreenshotType_Stereo, EVRScreenshotType_VRScreenshotType_Stereo,
+		EVRScreenshotType_VRScreenshotType_Stereo, EVRScreenshotType_VRScreenshotType_Mono,
+		EVRScreenshotType_VRScreenshotType_Cubemap, SCREENSHOT_TYPE_MIRROR };
+	uint64_t * seed = &catalogBench.seed;
+	memset( r, 0, sizeof( *r ) );
+	r->magic = CATALOG_MAGIC;
+	r->version = CATALOG_VERSION;
+	r->size = sizeof( *r );
+	catalogBench.time += 1 + CatalogBenchRandom( seed ) % 10;
+	r->time = r->sortTime = r->scheduled = catalogBench.time;
+	r->type = types[CatalogBenchRandom( seed ) % ( sizeof( types ) / sizeof( types[0] ) )];
+	r->error = CatalogBenchRandom( seed ) % 50 ? CatalogError_None : CatalogError_NotSaved;
+	r->previewBytes = r->error ? -1 : 200000;
+	r->vrBytes = r->error ? -1 : 4000000;
+	r->hash = CatalogBenchRandom( seed );
+	snprintf( r->appKey, sizeof( r->appKey ), "steam.app.%d", (int)( CatalogBenchRandom( seed ) % CATALOG_BENCH_APPS ) );
+	snprintf( r->vr, sizeof( r->vr ), "Screenshots" PLATFORM_SEPARATOR_STRING "bench" PLATFORM_SEPARATOR_STRING "%lld_vr.png", catalogBench.made );
+	catalogBench.made++;
+}
+
+// Adds count records to the end of the bench catalog, a batch at a time like PISS does.
+bool CatalogBenchAppend( long long count )
+{
+	struct CatalogBatch * b = &catalogBench.batch;
+	for( long long i = 0; i < count; i++ )
+	{
+		CatalogBenchRecord( &b->records[b->count++] );
+		if( ( b->count == CATALOG_BATCH || i == count - 1 ) && !CatalogWrite( b, catalogBenchPath, catalogBenchIndexPath ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void * CatalogBenchAppender( void * unused )
+{
+	for( int added = 0; added < CATALOG_BENCH_APPENDS; added += CATALOG_BATCH )
+	{
+		if( !CatalogBenchAppend( CATALOG_BATCH ) )
+		{
+			atomic_store( &catalogBench.writeFailed, 1 );
+			break;
+		}
+		OGUSleep( 200 );
+	}
+	atomic_store( &catalogBench.appending, 0 );
+	return NULL;
+}
+
+long long CatalogBenchQuery( const struct CatalogReader * c, const struct CatalogQuery * q )
+{
+	uint64_t at = CatalogQueryStart( c, q );
+	long long found = 0;
+	while( CatalogQueryNext( c, q, &at ) )
+	{
+		found++;
+	}
+	return found;
+}
+
+// The same query the slow way, reading every record, to check it against.
+long long CatalogBenchScan( const struct CatalogReader * c, const struct CatalogQuery * q )
+{
+	long long found = 0;
+	for( uint64_t i = 0; i < c->count; i++ )
+	{
+		const struct CatalogRecord * r = &c->r[i];
+		if( ( !q->from || r->sortTime >= q->from ) && ( !q->to || r->sortTime < q->to ) && CatalogQueryMatches( q, r ) )
+		{
+			found++;
+		}
+	}
+	return found;
+}
+
+// The same for a query that runs to the end, reading back from the last record.
+long long CatalogBenchScanEnd( const struct CatalogReader * c, const struct CatalogQuery * q )
+{
+	long long found = 0;
+	for( uint64_t i = c->count; i > 0 && c->r[i - 1].sortTime >= q->from; i-- )
+	{
+		found += CatalogQueryMatches( q, &c->r[i - 1] );
+	}
+	return found;
+}
+
+void CatalogBenchCheck( bool right, const char * what, long long got, long long expected )
+{
+	catalogBench.checked++;
+	if( !right )
+	{
+		if( catalogBench.wrong++ < 10 )
+		{
+			printf( "Error!!!! %s: got %lld, should be %lld\n", what, got, expected );
+		}
+	}
+}
+
+// A query for span seconds somewhere in the catalog, maybe only for one app, one type or both.
+void CatalogBenchRandomQuery( const struct CatalogReader * c, uint64_t * seed, struct CatalogQuery * q, char * app, size_t appSize, int64_t span, bool filtered )
+{
+	int64_t first = c->r[0].sortTime;
+	int64_t last = c->r[c->count - 1].sortTime;
+	q->from = first + (int64_t)( CatalogBenchRandom( seed ) % (uint64_t)( last - first + 1 ) );
+	q->to = q->from + span;
+	q->app = NULL;
+	q->type = -1;
+	if( filtered )
+	{
+		snprintf( app, appSize, "steam.app.%d", (int)( CatalogBenchRandom( seed ) % CATALOG_BENCH_APPS ) );
+		q->app = app;
+		q->type = CatalogBenchRandom( seed ) % 2 ? EVRScreenshotType_VRScreenshotType_Stereo : SCREENSHOT_TYPE_MIRROR;
+	}
+}
+
+// Every record in the view has to be sealed and in order.
+void CatalogBenchCheckView( const struct CatalogReader * c, uint64_t from )
+{
+	uint64_t bad = c->count;
+	for( uint64_t i = from; i < c->count && bad == c->count; i++ )
+	{
+		if( !CatalogRecordSealed( &c->r[i], i ) || ( i && c->r[i].sortTime < c->r[i - 1].sortTime ) )
+		{
+			bad = i;
+		}
+	}
+	CatalogBenchCheck( bad == c->count, "first bad record", (long long)bad, (long long)c->count );
+}
+
+// PISS starting again on the catalog with the clock an hour behind its last record, after dying
+// half way through writing one. New records have to go on after the last sealed one, numbered
+// on from it, and not before it in time.
+void CatalogBenchRestart( struct CatalogReader * reader )
+{
+	struct CatalogRecord r;
+	FILE * f = fopen( catalogBenchPath, "ab" );
+	if( f )
+	{
+		CatalogBenchRecord( &r );
+		fwrite( &r, CATALOG_RECORD_SIZE / 2, 1, f );
+		fclose( f );
+	}
+	uint64_t before = reader->count;
+	int64_t lastTime = reader->r[before - 1].sortTime;
+
+	struct Catalog * c = &catalogBench.restarted;
+	CatalogStart( c, catalogBenchPath );
+	CatalogBenchCheck( c->numbered == before, "numbered from after a restart", (long long)c->numbered, (long long)before );
+	CatalogBenchCheck( c->lastTime == lastTime, "last time after a restart", c->lastTime, lastTime );
+	for( int i = 0; i < CATALOG_BATCH; i++ )
+	{
+		CatalogBenchRecord( &r );
+		r.time = r.scheduled = lastTime - 3600 + i;
+		uint64_t ticket = CatalogReserve( c, &r, 0 );
+		CatalogFinish( c, ticket, r.error, NULL, NULL, r.previewBytes, r.vrBytes, r.hash );
+	}
+	CatalogRelease( c, 0 );
+	struct CatalogBatch * batch = CatalogTakeBatch( c );
+	bool written = batch && CatalogWrite( batch, catalogBenchPath, catalogBenchIndexPath );
+	CatalogBenchCheck( written, "restarted batch written", written, 1 );
+
+	CatalogReaderRefresh( reader );
+	CatalogBenchCheck( reader->count == before + CATALOG_BATCH, "records after a restart", (long long)reader->count, (long long)( before + CATALOG_BATCH ) );
+	CatalogBenchCheckView( reader, before - 1 );
+	const struct CatalogRecord * last = &reader->r[reader->count - 1];
+	CatalogBenchCheck( last->sortTime == lastTime, "sort time after a restart", last->sortTime, lastTime );
+	CatalogBenchCheck( last->time == lastTime - 3600 + CATALOG_BATCH - 1, "real time after a restart", last->time, lastTime - 3600 + CATALOG_BATCH - 1 );
+	uint64_t entries = ( reader->count + CATALOG_INDEX_EVERY - 1 ) / CATALOG_INDEX_EVERY;
+	CatalogBenchCheck( reader->entryCount == entries, "index entries after a restart", (long long)reader->entryCount, (long long)entries );
+	struct CatalogQuery q = { lastTime, 0, NULL, -1 };
+	long long got = CatalogBenchQuery( reader, &q );
+	long long expected = CatalogBenchScan( reader, &q );
+	CatalogBenchCheck( got == expected, "query after a restart", got, expected );
+}
+
+int CatalogBench( int argc, char ** argv )
+{
+	long long records = argc > 0 ? atoll( argv[0] ) : 1000000;
+	if( records < CATALOG_INDEX_EVERY )
+	{
+		printf( "Error!!!! --bench-catalog wants at least %d records\n", CATALOG_INDEX_EVERY );
+		return -7;
+	}
+	PathsInit();
+	PlatformMakeFolder( screenshotsFolder );
+	remove( catalogBenchPath );
+	remove( catalogBenchIndexPath );
+	catalogBench.seed = 0x9e3779b97f4a7c15ull;
+	catalogBench.time = 1700000000;
+
+	double start = OGGetAbsoluteTime();
+	if( !CatalogBenchAppend( records ) )
+	{
+		printf( "Error!!!! Couldn't write %s\n", catalogBenchPath );
+		return 1;
+	}
+	double writeSeconds = OGGetAbsoluteTime() - start;
+	printf( "Catalog: %lld records, %.0f MB, written in %.2f s (%.0f records/s).\n", records,
+		records * (double)CATALOG_RECORD_SIZE / ( 1024.0 * 1024.0 ), writeSeconds, records / writeSeconds );
+
+	struct CatalogReader reader;
+	start = OGGetAbsoluteTime();
+	CatalogReaderOpen( &reader, catalogBenchPath, catalogBenchIndexPath );
+	printf( "Open: %.3f ms, %llu records, %llu index entries.\n", ( OGGetAbsoluteTime() - start ) * 1000.0,
+		(unsigned long long)reader.count, (unsigned long long)reader.entryCount );
+	CatalogBenchCheck( reader.count == (uint64_t)records, "records in the view", (long long)reader.count, records );
+	CatalogBenchCheckView( &reader, 0 );
+
+	// Finding times. Right if it's the first record at or after the time.
+	uint64_t seed = 0x2545f4914f6cdd1dull;
+	int64_t first = reader.r[0].sortTime;
+	int64_t span = reader.r[reader.count - 1].sortTime - first + 1;
+	int64_t * times = malloc( CATALOG_BENCH_LOOKUPS * sizeof( times[0] ) );
+	uint64_t * found = malloc( CATALOG_BENCH_LOOKUPS * sizeof( found[0] ) );
+	if( !times || !found )
+	{
+		printf( "Error!!!! Out of memory for lookups\n" );
+		return 1;
+	}
+	for( int i = 0; i < CATALOG_BENCH_LOOKUPS; i++ )
+	{
+		times[i] = first + (int64_t)( CatalogBenchRandom( &seed ) % (uint64_t)span );
+	}
+	start = OGGetAbsoluteTime();
+	for( int i = 0; i < CATALOG_BENCH_LOOKUPS; i++ )
+	{
+		found[i] = CatalogReaderFind( &reader, times[i] );
+	}
+	double lookupSeconds = OGGetAbsoluteTime() - start;
+	for( int i = 0; i < CATALOG_BENCH_LOOKUPS; i++ )
+	{
+		uint64_t at = found[i];
+		bool right = ( at == reader.count || reader.r[at].sortTime >= times[i] ) && ( at == 0 || reader.r[at - 1].sortTime < times[i] );
+		CatalogBenchCheck( right, "lookup", (long long)at, -1 );
+	}
+	printf( "Find a time: %.0f ns per lookup.\n", lookupSeconds * 1e9 / CATALOG_BENCH_LOOKUPS );
+	free( times );
+	free( found );
+
+	// Hour long queries, then a filtered query over everything, which has to read every record.
+	for( int filtered = 0; filtered < 2; filtered++ )
+	{
+		struct CatalogQuery q;
+		char app[32];
+		long long matched = 0;
+		double querySeconds = 0;
+		for( int i = 0; i < CATALOG_BENCH_QUERIES; i++ )
+		{
+			CatalogBenchRandomQuery( &reader, &seed, &q, app, sizeof( app ), 3600, filtered );
+			start = OGGetAbsoluteTime();
+			long long n = CatalogBenchQuery( &reader, &q );
+			querySeconds += OGGetAbsoluteTime() - start;
+			matched += n;
+			if( i < CATALOG_BENCH_CHECKED )
+			{
+				long long expected = CatalogBenchScan( &reader, &q );
+				CatalogBenchCheck( n == expected, "hour query", n, expected );
+			}
+		}
+		printf( "An hour, %s: %.2f us per query, %.1f records each.\n", filtered ? "one app and type" : "everything",
+			querySeconds * 1e6 / CATALOG_BENCH_QUERIES, (double)matched / CATALOG_BENCH_QUERIES );
+	}
+	struct CatalogQuery all = { 0, 0, "steam.app.3", -1 };
+	start = OGGetAbsoluteTime();
+	long long n = CatalogBenchQuery( &reader, &all );
+	double scanSeconds = OGGetAbsoluteTime() - start;
+	long long expected = CatalogBenchScan( &reader, &all );
+	CatalogBenchCheck( n == expected, "whole catalog query", n, expected );
+	printf( "All time, one app: %.1f ms, %lld records.\n", scanSeconds * 1000.0, n );
+
+	// Reading while the catalog grows. Each time it's grown, everything new has to be sealed and
+	// in order, and queries over the end have to match reading every record.
+	atomic_store( &catalogBench.appending, 1 );
+	og_thread_t appender = OGCreateThread( CatalogBenchAppender, NULL );
+	int refreshes = 0;
+	double refreshSeconds = 0;
+	while( atomic_load( &catalogBench.appending ) )
+	{
+		uint64_t before = reader.count;
+		start = OGGetAbsoluteTime();
+		if( !CatalogReaderRefresh( &reader ) )
+		{
+			OGUSleep( 100 );
+			continue;
+		}
+		refreshSeconds += OGGetAbsoluteTime() - start;
+		refreshes++;
+		CatalogBenchCheck( reader.count >= before, "records after a refresh", (long long)reader.count, (long long)before );
+		CatalogBenchCheckView( &reader, before ? before - 1 : 0 );
+		struct CatalogQuery q = { reader.r[reader.count - 1].sortTime - 600, 0, NULL, -1 };
+		long long got = CatalogBenchQuery( &reader, &q );
+		long long expected = CatalogBenchScanEnd( &reader, &q );
+		CatalogBenchCheck( got == expected, "query over the end", got, expected );
+	}
+	OGJoinThread( appender );
+	CatalogReaderRefresh( &reader );
+	CatalogBenchCheckView( &reader, 0 );
+	CatalogBenchCheck( reader.count == (uint64_t)catalogBench.made, "records at the end", (long long)reader.count, catalogBench.made );
+	printf( "While adding %d records: %d refreshes, %.1f us each.\n", CATALOG_BENCH_APPENDS, refreshes,
+		refreshes ? refreshSeconds * 1e6 / refreshes : 0.0 );
+	CatalogBenchRestart( &reader );
+
+	CatalogReaderClose( &reader );
+	remove( catalogBenchPath );
+	remove( catalogBenchIndexPath );
+	if( atomic_load( &catalogBench.writeFailed ) )
+	{
+		printf( "Error!!!! Couldn't add to %s\n", catalogBenchPath );
+		return 1;
+	}
+	printf( "%lld of %lld checks right.\n", catalogBench.checked - catalogBench.wrong, catalogBench.checked );
+	return catalogBench.wrong ? 1 : 0;
+}
+
+int main( int argc, char ** argv )
+{
+	if( argc > 1 && strcmp( argv[1], "--find" ) == 0 )
+	{
+		return FindCaptures( argc - 2, argv + 2 );
+	}
+	if( argc > 1 && strcmp( argv[1], "--bench-catalog" ) == 0 )
+	{
+		return CatalogBench( argc - 2, argv + 2 );
+	}
+	if( argc > 1 && strcmp( argv[1], "--simulate" ) == 0 && !SimulateStart( argc - 2, argv + 2 ) )
+	{
+		return -7;
+	}
+	if( argc > 1 && strcmp( argv[1], "--bench" ) == 0 && !BenchStart( argc - 2, argv + 2 ) )
+	{
+		return -7;
+	}
+
+    // We put this in a codeblock because it's logically together.
+	// no reason to keep the token around. Simulations don't talk to SteamVR at all.
+	if( !virtualClock.on )
+	{
+		EVRInitError ierr;
+		uint32_t token = VR_InitInternal( &ierr, EVRApplicationType_VRApplication_Overlay );
+		if( !token )
+		{
+			printf( "Error!!!! Could not initialize OpenVR\n" );
+			return -5;
+		}
+
+		// Get the system and overlay interfaces.  We pass in the version of these
+		// interfaces that we wish to use, in case the runtime is newer, we can still
+		// get the interfaces we expect.
+		oSystem = CNOVRGetOpenVRFunctionTable( IVRSystem_Version );
+		//oOverlay = CNOVRGetOpenVRFunctionTable( IVROverlay_Version );
+		oApplications = CNOVRGetOpenVRFunctionTable( IVRApplications_Version );
+		oScreenshots = CNOVRGetOpenVRFunctionTable( IVRScreenshots_Version );
+		oCompositor = CNOVRGetOpenVRFunctionTable( IVRCompositor_Version );
+		//oInput = CNOVRGetOpenVRFunctionTable( IVRInput_Version );
+	}
+
+	PathsInit();
+	if( bench.on )
+	{
+		BenchUseScratchFiles();
+	}
+	if( !virtualClock.on )
+	{
+		if (!oApplications->IsApplicationInstalled("iigo.PISS"))
+		{
+			EVRApplicationError app_error;
+			app_error = oApplications->AddApplicationManifest((char *)manifestPath, false);
+			if( app_error != EVRApplicationError_VRApplicationError_None )
+			{
+				printf( "Couldn't register %s with SteamVR, it won't start with SteamVR (%s).\n", manifestPath,
+					oApplications->GetApplicationsErrorNameFromEnum( app_error ) );
+			}
+		}
+	}
+
+	LoadConfig();
+	if( bench.on )
+	{
+		schedule.ruleCount = 0;
+		ScheduleAddRule( &schedule, &bench.rule );
+	}
+	if( hookScreenshots && !virtualClock.on )
+	{
+		// Only stereo, the other types would come straight back to us when we asked for them.
+		EVRScreenshotType hooked[] = { EVRScreenshotType_VRScreenshotType_Stereo };
+		EVRScreenshotError err = oScreenshots->HookScreenshot( hooked, 1 );
+		printf( "Taking over SteamVR screenshots (%d).\n", err );
+	}
+	CaptureTimerInit();
+	if( !virtualClock.on )
+	{
+		FoldersInit();
+	}
+	indexLock = OGCreateMutex();
+	CatalogStart( &catalog, catalogPath );
+	WorkerPoolStart( &workers, workerThreads, RunPostCaptureJob );
+	if( !virtualClock.on )
+	{
+		MirrorCaptureInit();
+	}
+
+	// What happens when a screenshot is done, all in one place because the order matters. The
+	// files have to be found before anything uses their names, the sidecar goes before the
+	// catalog record (both after the timings they copy), and the retry comes after everything
+	// that records the failure, so the shot isn't set up again until they've all seen it. The
+	// bench only keeps saved screenshots, so it can go anywhere.
+	HandleTableOnComplete( &captures, ResolveCaptureFiles );
+	HandleTableOnComplete( &captures, SubmitHookedScreenshot );
+	HandleTableOnComplete( &captures, RecordCaptureTimings );
+	HandleTableOnComplete( &captures, RecordFrameCost );
+	HandleTableOnComplete( &captures, QueuePostCapture );
+	HandleTableOnComplete( &captures, RecordSidecar );
+	HandleTableOnComplete( &captures, RecordCatalog );
+	HandleTableOnComplete( &captures, ForgetFoldersOnFailure );
+	HandleTableOnComplete( &captures, RetryFailedCapture );
+	if( bench.on )
+	{
+		HandleTableOnComplete( &captures, BenchKeepSample );
+	}
+	PlatformCatchStatsKey( &statsRequested );
+
+	time_t now = ClockNow();
+	ClockWatchStart( &clockWatch, now, MonotonicNow() );
+	ScheduleStart( &schedule, now );
+	clock_t cpuStart = clock();
+
+    while( true )
+    {
+		time_t deadline = SchedulePeek( &schedule );
+		if( queuedCaptures && !CapturePipelineBusy() && ( !deadline || lastCaptureTime + CATCH_UP_SPACING < deadline ) )
+		{
+			deadline = lastCaptureTime + CATCH_UP_SPACING;
+		}
+		if( !deadline )
+		{
+			printf( "Error!!!! None of the schedule rules will ever fire\n" );
+			return -6;
+		}
+
+		bool due = CaptureTimerWait( deadline, EventPollWait() );
+		if( virtualClock.on && virtualClock.now >= virtualClock.end )
+		{
+			break;
+		}
+		if( !virtualClock.on && !HandleVREvents() )
+		{
+			break;
+		}
+		if( bench.on && !ServiceBench() )
+		{
+			break;
+		}
+		ServiceMirror();
+		ServiceReplayFrames();
+		ServiceSidecar();
+		ServiceCatalog();
+		ServiceDeferredCapture();
+		ServiceFrameGate();
+		ServiceRetry();
+		ServiceBurst();
+		ServiceCaptureQueue( ClockNow() );
+		WorkerPoolDrain( &workers, FinishPostCaptureJob );
+		if( statsRequested )
+		{
+			statsRequested = 0;
+			WriteLatencyStats();
+		}
+		if( !due )
+		{
+			continue;
+		}
+		now = ClockNow();
+
+		switch( ClockWatchCheck( &clockWatch, now, MonotonicNow(), deadline ) )
+		{
+		case ClockChange_Jump:
+			printf( "Wall clock jumped %+.0f s (or the machine was asleep).\n", clockWatch.lastChange );
+			if( clockWatch.lastChange < 0 )
+			{
+				// Everything in the heap is now further away than it should be, so work it all out again.
+				ScheduleStart( &schedule, now );
+				continue;
+			}
+			break;
+		case ClockChange_Resume:
+			printf( "Woke up %.0f s late, the machine was probably asleep.\n", clockWatch.lastChange );
+			break;
+		}
+
+		// The timer can come back a little early (or the clock can be moved backwards), in which
+		// case we just go back to waiting for the same deadline.
+		if( now < deadline )
+		{
+			continue;
+		}
+
+		ServiceSchedule( now );
+		ServiceCaptureQueue( now );
+    }
+
+	if( bench.on )
+	{
+		BenchFinishCaptures();
+		BenchPostProcessing();
+		BenchPathBuilding();
+	}
+	FlushSidecar();
+	int abandoned = WorkerPoolStop( &workers, 10.0, FinishPostCaptureJob );
+	if( abandoned )
+	{
+		printf( "Gave up waiting on %d post-capture job(s).\n", abandoned );
+	}
+	if( sidecarBatches[sidecarCurrent].count && !abandoned )
+	{
+		// Left over because the other batch was still being written when we flushed.
+		SidecarWrite( &sidecarBatches[sidecarCurrent], sidecarPath );
+	}
+	if( !abandoned )
+	{
+		CloseCatalog();
+	}
+	if( virtualClock.on )
+	{
+		return SimulateReport( (double)( clock() - cpuStart ) / CLOCKS_PER_SEC );
+	}
+	int result = bench.on ? BenchReport() : 0;
+	MirrorStop( &mirror, oCompositor );
+	WriteLatencyStats();
+	VR_ShutdownInternal();
+	return result;
 }
\ No newline at end of file
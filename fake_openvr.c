@@ -0,0 +1,700 @@
+// A stand-in for SteamVR's openvr_api library, so PISS can be run and load tested on a box with
+// no headset and no SteamVR. Build it as libopenvr_api.so (the "fake OpenVR runtime (Linux)"
+// task) next to PISS and PISS will pick it up instead of the real one.
+//
+// Only the calls PISS makes are filled in, everything else in the function tables is left
+// NULL. Screenshots are handed to a thread that waits a while, as if the compositor were busy
+// rendering and encoding, writes a made-up PNG where it was asked to, and then sends
+// ScreenshotTaken (or ScreenshotFailed). Like SteamVR, it only does one screenshot at a time.
+//
+// How it behaves is set with environment variables:
+//
+//	FAKE_OPENVR_LATENCY_MS	how long a screenshot takes to save (default 400)
+//	FAKE_OPENVR_JITTER_MS	up to this much longer, at random (default 200)
+//	FAKE_OPENVR_FAIL_RATE	fraction of screenshots that fail while saving (default 0)
+//	FAKE_OPENVR_BUSY_RATE	fraction of requests turned down straight away (default 0)
+//	FAKE_OPENVR_WIDTH		preview image size, the VR image is twice as wide for stereo (default 1024)
+//	FAKE_OPENVR_HEIGHT		(default 1024)
+//	FAKE_OPENVR_QUIT_AFTER	seconds until it tells PISS SteamVR is quitting (default never)
+//	FAKE_OPENVR_IDLE		1 to say nobody is wearing the headset
+//	FAKE_OPENVR_NO_SCENE	1 to say no game is running
+//	FAKE_OPENVR_HOOK_EVERY	seconds between screenshots "the user takes", sent as RequestScreenshot
+//							once PISS has hooked them (default never)
+//	FAKE_OPENVR_MIRROR		1 to hand out a mirror texture, a gradient the size of the preview
+//							made in PISS's GL context, so mirror and replay captures work
+//	FAKE_OPENVR_SEED		for the random numbers, so runs can be repeated (default 1)
+//
+// When it shuts down it prints what it did, for checking against what PISS says it did.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#undef EXTERN_C
+#include "openvr_capi.h"
+#include "os_generic.h"
+
+#if defined( _WIN32 )
+#include <windows.h>
+#endif
+#include <GL/gl.h>
+
+#if defined( _WIN32 )
+#define FAKE_API __declspec( dllexport )
+#else
+#define FAKE_API __attribute__( ( visibility( "default" ) ) )
+#endif
+
+#define FAKE_EVENTS 256
+#define FAKE_FILES 64				// screenshots we remember the file names of
+#define FAKE_PID 4242
+#define FAKE_FRAME_RATE 90.0
+
+struct FakeConfig
+{
+	int latencyMs;
+	int jitterMs;
+	double failRate;
+	double busyRate;
+	int width;
+	int height;
+	double quitAfter;
+	bool idle;
+	bool noScene;
+	double hookEvery;
+	bool mirror;
+};
+
+struct FakeScreenshot
+{
+	ScreenshotHandle_t handle;
+	EVRScreenshotType type;
+	double delay;					// seconds it'll take
+	bool fail;
+	char preview[1024];
+	char vr[1024];
+};
+
+struct Fake
+{
+	struct FakeConfig config;
+	og_mutex_t lock;
+	og_sema_t work;
+	og_thread_t writer;
+	volatile int running;
+	double started;
+	uint64_t random;
+
+	struct VREvent_t events[FAKE_EVENTS];
+	int eventHead;
+	int eventCount;
+	bool quitSent;
+	bool hooked;					// PISS has asked for stereo screenshots
+	double nextHook;
+
+	bool busy;						// a screenshot is being written
+	struct FakeScreenshot current;
+	struct FakeScreenshot files[FAKE_FILES];
+	ScreenshotHandle_t nextHandle;
+	uint32_t droppedFrames;			// frames the screenshots have "cost" the game
+
+	long long requested;
+	long long refused;
+	long long taken;
+	long long failed;
+	long long submitted;
+	long long hookRequests;
+	double bytesWritten;
+};
+
+static struct Fake fake;
+
+static double FakeEnv( const char * name, double fallback )
+{
+	const char * v = getenv( name );
+	return v && *v ? atof( v ) : fallback;
+}
+
+// xorshift64*, plenty for deciding which screenshots fail.
+static double FakeRandom()
+{
+	fake.random ^= fake.random >> 12;
+	fake.random ^= fake.random << 25;
+	fake.random ^= fake.random >> 27;
+	return ( ( fake.random * 0x2545F4914F6CDD1Dull ) >> 11 ) / (double)( 1ull << 53 );
+}
+
+static void FakePushEvent( uint32_t type, ScreenshotHandle_t handle, EVRScreenshotType screenshotType )
+{
+	OGLockMutex( fake.lock );
+	if( fake.eventCount < FAKE_EVENTS )
+	{
+		struct VREvent_t * e = &fake.events[( fake.eventHead + fake.eventCount++ ) % FAKE_EVENTS];
+		memset( e, 0, sizeof( *e ) );
+		e->eventType = type;
+		e->data.screenshot.handle = handle;
+		e->data.screenshot.type = screenshotType;
+	}
+	OGUnlockMutex( fake.lock );
+}
+
+// A PNG with the image data in stored (uncompressed) deflate blocks, so there's no need for zlib.
+// It's what a real one costs to write, give or take the compression.
+static uint32_t fakeCrcTable[256];
+
+static uint32_t FakeCrc( uint32_t crc, const unsigned char * p, size_t n )
+{
+	if( !fakeCrcTable[1] )
+	{
+		for( uint32_t i = 0; i < 256; i++ )
+		{
+			uint32_t c = i;
+			for( int k = 0; k < 8; k++ )
+			{
+				c = c & 1 ? 0xedb88320u ^ ( c >> 1 ) : c >> 1;
+			}
+			fakeCrcTable[i] = c;
+		}
+	}
+	crc = ~crc;
+	while( n-- )
+	{
+		crc = fakeCrcTable[( crc ^ *p++ ) & 0xff] ^ ( crc >> 8 );
+	}
+	return ~crc;
+}
+
+static void FakePut32( unsigned char * p, uint32_t v )
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static bool FakeChunk( FILE * f, const char * type, const unsigned char * data, uint32_t size )
+{
+	unsigned char header[8], footer[4];
+	FakePut32( header, size );
+	memcpy( header + 4, type, 4 );
+	uint32_t crc = FakeCrc( FakeCrc( 0, header + 4, 4 ), data, size );
+	FakePut32( footer, crc );
+	return fwrite( header, 1, 8, f ) == 8 && fwrite( data, 1, size, f ) == size && fwrite( footer, 1, 4, f ) == 4;
+}
+
+static bool FakeWritePNG( const char * path, int width, int height, uint32_t seed )
+{
+	size_t rowSize = (size_t)width * 3 + 1;
+	size_t rawSize = rowSize * height;
+	size_t blocks = ( rawSize + 65534 ) / 65535;
+	size_t idatSize = 2 + rawSize + blocks * 5 + 4;
+	unsigned char * idat = malloc( idatSize );
+	unsigned char * row = malloc( rowSize );
+	if( !idat || !row )
+	{
+		free( idat );
+		free( row );
+		return false;
+	}
+
+	// A gradient that's a different colour for each screenshot.
+	unsigned char * o = idat;
+	*o++ = 0x78; *o++ = 0x01;
+	uint32_t a = 1, b = 0;
+	size_t left = 0, done = 0;
+	for( int y = 0; y < height; y++ )
+	{
+		row[0] = 0;
+		for( int x = 0; x < width; x++ )
+		{
+			row[1 + x * 3] = x * 255 / width;
+			row[2 + x * 3] = y * 255 / height;
+			row[3 + x * 3] = seed * 40;
+		}
+		for( size_t i = 0; i < rowSize; i++ )
+		{
+			if( !left )
+			{
+				left = rawSize - done < 65535 ? rawSize - done : 65535;
+				*o++ = done + left == rawSize;
+				*o++ = left; *o++ = left >> 8;
+				*o++ = ~left; *o++ = ~left >> 8;
+			}
+			*o++ = row[i];
+			a = ( a + row[i] ) % 65521;
+			b = ( b + a ) % 65521;
+			left--;
+			done++;
+		}
+	}
+	FakePut32( o, b << 16 | a );
+	o += 4;
+
+	unsigned char ihdr[13] = { 0 };
+	FakePut32( ihdr, width );
+	FakePut32( ihdr + 4, height );
+	ihdr[8] = 8;		// bits per channel
+	ihdr[9] = 2;		// RGB
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	FILE * f = fopen( path, "wb" );
+	bool ok = f && fwrite( signature, 1, 8, f ) == 8 && FakeChunk( f, "IHDR", ihdr, 13 ) &&
+		FakeChunk( f, "IDAT", idat, o - idat ) && FakeChunk( f, "IEND", NULL, 0 );
+	if( f )
+	{
+		ok = fclose( f ) == 0 && ok;
+	}
+	if( ok )
+	{
+		fake.bytesWritten += 8 + 25 + 12 + ( o - idat ) + 12;
+	}
+	free( idat );
+	free( row );
+	return ok;
+}
+
+static void * FakeWriter( void * v )
+{
+	while( fake.running )
+	{
+		OGLockSema( fake.work );
+		if( !fake.running )
+		{
+			break;
+		}
+		struct FakeScreenshot * s = &fake.current;
+		struct FakeConfig * c = &fake.config;
+		OGUSleep( (int)( s->delay * 1000000 ) );
+
+		bool stereo = s->type == EVRScreenshotType_VRScreenshotType_Stereo;
+		bool ok = !s->fail &&
+			FakeWritePNG( s->preview, c->width, c->height, s->handle ) &&
+			FakeWritePNG( s->vr, stereo ? c->width * 2 : c->width, c->height, s->handle );
+
+		// Once busy is cleared the next request can fill in current, so take what the event needs first.
+		OGLockMutex( fake.lock );
+		ScreenshotHandle_t handle = s->handle;
+		EVRScreenshotType type = s->type;
+		fake.files[handle % FAKE_FILES] = *s;
+		fake.busy = false;
+		fake.droppedFrames += 2;
+		if( ok ) fake.taken++;
+		else fake.failed++;
+		OGUnlockMutex( fake.lock );
+		FakePushEvent( ok ? EVREventType_VREvent_ScreenshotTaken : EVREventType_VREvent_ScreenshotFailed, handle, type );
+	}
+	return 0;
+}
+
+// IVRScreenshots
+
+static EVRScreenshotError OPENVR_FNTABLE_CALLTYPE FakeRequestScreenshot( ScreenshotHandle_t * handle, EVRScreenshotType type, char * preview, char * vr )
+{
+	*handle = k_unScreenshotHandleInvalid;
+	OGLockMutex( fake.lock );
+	fake.requested++;
+	EVRScreenshotError err = EVRScreenshotError_VRScreenshotError_None;
+	if( fake.busy )
+	{
+		err = EVRScreenshotError_VRScreenshotError_ScreenshotAlreadyInProgress;
+	}
+	else if( FakeRandom() < fake.config.busyRate )
+	{
+		err = EVRScreenshotError_VRScreenshotError_RequestFailed;
+	}
+	else
+	{
+		fake.busy = true;
+		struct FakeScreenshot * s = &fake.current;
+		s->handle = *handle = ++fake.nextHandle;
+		s->type = type;
+		s->delay = ( fake.config.latencyMs + fake.config.jitterMs * FakeRandom() ) / 1000.0;
+		s->fail = FakeRandom() < fake.config.failRate;
+		snprintf( s->preview, sizeof( s->preview ), "%s.png", preview );
+		snprintf( s->vr, sizeof( s->vr ), "%s.png", vr );
+	}
+	if( err )
+	{
+		fake.refused++;
+	}
+	OGUnlockMutex( fake.lock );
+	if( !err )
+	{
+		OGUnlockSema( fake.work );
+	}
+	return err;
+}
+
+static EVRScreenshotError OPENVR_FNTABLE_CALLTYPE FakeTakeStereoScreenshot( ScreenshotHandle_t * handle, char * preview, char * vr )
+{
+	return FakeRequestScreenshot( handle, EVRScreenshotType_VRScreenshotType_Stereo, preview, vr );
+}
+
+static EVRScreenshotError OPENVR_FNTABLE_CALLTYPE FakeHookScreenshot( EVRScreenshotType * types, int count )
+{
+	OGLockMutex( fake.lock );
+	fake.hooked = false;
+	for( int i = 0; i < count; i++ )
+	{
+		fake.hooked |= types[i] == EVRScreenshotType_VRScreenshotType_Stereo;
+	}
+	fake.nextHook = OGGetAbsoluteTime() + fake.config.hookEvery;
+	OGUnlockMutex( fake.lock );
+	return EVRScreenshotError_VRScreenshotError_None;
+}
+
+static EVRScreenshotError OPENVR_FNTABLE_CALLTYPE FakeSubmitScreenshot( ScreenshotHandle_t handle, EVRScreenshotType type, char * preview, char * vr )
+{
+	fake.submitted++;
+	return EVRScreenshotError_VRScreenshotError_None;
+}
+
+static uint32_t OPENVR_FNTABLE_CALLTYPE FakeGetScreenshotPropertyFilename( ScreenshotHandle_t handle, EVRScreenshotPropertyFilenames which, char * file, uint32_t size, EVRScreenshotError * err )
+{
+	OGLockMutex( fake.lock );
+	struct FakeScreenshot * s = &fake.files[handle % FAKE_FILES];
+	uint32_t length = 0;
+	if( s->handle != handle )
+	{
+		*err = EVRScreenshotError_VRScreenshotError_NotFound;
+	}
+	else
+	{
+		const char * name = which == EVRScreenshotPropertyFilenames_VRScreenshotPropertyFilenames_VR ? s->vr : s->preview;
+		length = strlen( name ) + 1;
+		*err = length > size ? EVRScreenshotError_VRScreenshotError_BufferTooSmall : EVRScreenshotError_VRScreenshotError_None;
+		if( length <= size )
+		{
+			memcpy( file, name, length );
+		}
+	}
+	OGUnlockMutex( fake.lock );
+	return length;
+}
+
+// IVRSystem
+
+static bool OPENVR_FNTABLE_CALLTYPE FakePollNextEvent( struct VREvent_t * event, uint32_t size )
+{
+	if( fake.config.quitAfter > 0 && !fake.quitSent && OGGetAbsoluteTime() - fake.started >= fake.config.quitAfter )
+	{
+		fake.quitSent = true;
+		FakePushEvent( EVREventType_VREvent_Quit, 0, 0 );
+	}
+	// The user pressing the screenshot buttons, which comes to PISS instead of SteamVR taking it.
+	OGLockMutex( fake.lock );
+	bool press = fake.config.hookEvery > 0 && fake.hooked && OGGetAbsoluteTime() >= fake.nextHook;
+	ScreenshotHandle_t handle = 0;
+	if( press )
+	{
+		fake.nextHook += fake.config.hookEvery;
+		fake.hookRequests++;
+		handle = ++fake.nextHandle;
+	}
+	OGUnlockMutex( fake.lock );
+	if( press )
+	{
+		FakePushEvent( EVREventType_VREvent_RequestScreenshot, handle, EVRScreenshotType_VRScreenshotType_Stereo );
+	}
+	OGLockMutex( fake.lock );
+	bool got = fake.eventCount > 0;
+	if( got )
+	{
+		memcpy( event, &fake.events[fake.eventHead], size < sizeof( *event ) ? size : sizeof( *event ) );
+		fake.eventHead = ( fake.eventHead + 1 ) % FAKE_EVENTS;
+		fake.eventCount--;
+	}
+	OGUnlockMutex( fake.lock );
+	return got;
+}
+
+static void OPENVR_FNTABLE_CALLTYPE FakeAcknowledgeQuit_Exiting()
+{
+}
+
+// The head a little above the floor slowly looking round, hands out in front.
+static void FakePose( TrackedDevicePose_t * pose, TrackedDeviceIndex_t device, double t )
+{
+	memset( pose, 0, sizeof( *pose ) );
+	float yaw = (float)( t * 0.1 );
+	float c = cosf( yaw ), s = sinf( yaw );
+	float ( *m )[4] = pose->mDeviceToAbsoluteTracking.m;
+	m[0][0] = c;  m[0][2] = s;
+	m[1][1] = 1;
+	m[2][0] = -s; m[2][2] = c;
+	m[0][3] = device == 1 ? -0.2f : device == 2 ? 0.2f : 0;
+	m[1][3] = device ? 1.2f : 1.7f;
+	m[2][3] = device ? -0.3f : 0;
+	pose->vAngularVelocity.v[1] = 0.1f;
+	pose->eTrackingResult = ETrackingResult_TrackingResult_Running_OK;
+	pose->bPoseIsValid = true;
+	pose->bDeviceIsConnected = true;
+}
+
+static void OPENVR_FNTABLE_CALLTYPE FakeGetDeviceToAbsoluteTrackingPose( ETrackingUniverseOrigin origin, float predict, TrackedDevicePose_t * poses, uint32_t count )
+{
+	double t = OGGetAbsoluteTime() - fake.started;
+	for( uint32_t i = 0; i < count; i++ )
+	{
+		if( i < 3 )
+		{
+			FakePose( &poses[i], i, t );
+		}
+		else
+		{
+			memset( &poses[i], 0, sizeof( poses[i] ) );
+		}
+	}
+}
+
+static EDeviceActivityLevel OPENVR_FNTABLE_CALLTYPE FakeGetTrackedDeviceActivityLevel( TrackedDeviceIndex_t device )
+{
+	return fake.config.idle ? EDeviceActivityLevel_k_EDeviceActivityLevel_Standby : EDeviceActivityLevel_k_EDeviceActivityLevel_UserInteraction;
+}
+
+static TrackedDeviceIndex_t OPENVR_FNTABLE_CALLTYPE FakeGetTrackedDeviceIndexForControllerRole( ETrackedControllerRole role )
+{
+	return role == ETrackedControllerRole_TrackedControllerRole_LeftHand ? 1 :
+		role == ETrackedControllerRole_TrackedControllerRole_RightHand ? 2 : k_unTrackedDeviceIndexInvalid;
+}
+
+static bool OPENVR_FNTABLE_CALLTYPE FakeIsTrackedDeviceConnected( TrackedDeviceIndex_t device )
+{
+	return device < 3;
+}
+
+// IVRApplications
+
+static EVRApplicationError OPENVR_FNTABLE_CALLTYPE FakeAddApplicationManifest( char * path, bool temporary )
+{
+	return EVRApplicationError_VRApplicationError_None;
+}
+
+static bool OPENVR_FNTABLE_CALLTYPE FakeIsApplicationInstalled( char * key )
+{
+	return true;
+}
+
+static char * OPENVR_FNTABLE_CALLTYPE FakeGetApplicationsErrorNameFromEnum( EVRApplicationError error )
+{
+	return error ? "VRApplicationError_Fake" : "VRApplicationError_None";
+}
+
+static uint32_t OPENVR_FNTABLE_CALLTYPE FakeGetCurrentSceneProcessId()
+{
+	return fake.config.noScene ? 0 : FAKE_PID;
+}
+
+static EVRApplicationError OPENVR_FNTABLE_CALLTYPE FakeGetApplicationKeyByProcessId( uint32_t pid, char * key, uint32_t size )
+{
+	if( pid != FAKE_PID )
+	{
+		return EVRApplicationError_VRApplicationError_InvalidParameter;
+	}
+	snprintf( key, size, "fake.game" );
+	return EVRApplicationError_VRApplicationError_None;
+}
+
+// IVRCompositor. The game runs at a steady 90 fps, and each screenshot costs it a couple of frames.
+
+static uint32_t OPENVR_FNTABLE_CALLTYPE FakeGetFrameTimings( Compositor_FrameTiming * timings, uint32_t count )
+{
+	double now = OGGetAbsoluteTime() - fake.started;
+	uint32_t frame = (uint32_t)( now * FAKE_FRAME_RATE );
+	OGLockMutex( fake.lock );
+	bool busy = fake.busy;
+	OGUnlockMutex( fake.lock );
+	for( uint32_t i = 0; i < count; i++ )
+	{
+		Compositor_FrameTiming * t = &timings[i];
+		memset( t, 0, sizeof( *t ) );
+		t->m_nSize = sizeof( *t );
+		t->m_nFrameIndex = frame - ( count - 1 - i );
+		t->m_nNumFramePresents = 1;
+		t->m_nNumDroppedFrames = busy && i == count - 1;
+		t->m_flSystemTimeInSeconds = now - ( count - 1 - i ) / FAKE_FRAME_RATE;
+		t->m_flTotalRenderGpuMs = 7.5f;
+		t->m_flCompositorRenderGpuMs = 0.8f;
+		t->m_flClientFrameIntervalMs = 1000.0f / FAKE_FRAME_RATE;
+	}
+	return count;
+}
+
+static void OPENVR_FNTABLE_CALLTYPE FakeGetCumulativeStats( Compositor_CumulativeStats * stats, uint32_t size )
+{
+	Compositor_CumulativeStats s;
+	memset( &s, 0, sizeof( s ) );
+	s.m_nPid = FAKE_PID;
+	s.m_nNumFramePresents = (uint32_t)( ( OGGetAbsoluteTime() - fake.started ) * FAKE_FRAME_RATE );
+	OGLockMutex( fake.lock );
+	s.m_nNumDroppedFrames = fake.droppedFrames;
+	s.m_nNumReprojectedFrames = fake.droppedFrames;
+	OGUnlockMutex( fake.lock );
+	memcpy( stats, &s, size < sizeof( s ) ? size : sizeof( s ) );
+}
+
+// There's no compositor to share a texture with, so unless FAKE_OPENVR_MIRROR is on mirror
+// captures just don't work. With it on the "mirror" is a still texture made in whatever GL
+// context PISS has current, which is all PISS needs to read it back.
+static EVRCompositorError OPENVR_FNTABLE_CALLTYPE FakeGetMirrorTextureGL( EVREye eye, glUInt_t * texture, glSharedTextureHandle_t * shared )
+{
+	struct FakeConfig * c = &fake.config;
+	unsigned char * pixels = c->mirror ? malloc( (size_t)c->width * c->height * 4 ) : NULL;
+	if( !pixels )
+	{
+		return EVRCompositorError_VRCompositorError_RequestFailed;
+	}
+	for( int y = 0; y < c->height; y++ )
+	{
+		for( int x = 0; x < c->width; x++ )
+		{
+			unsigned char * p = pixels + ( (size_t)y * c->width + x ) * 4;
+			p[0] = x * 255 / c->width;
+			p[1] = y * 255 / c->height;
+			p[2] = eye * 255;
+			p[3] = 255;
+		}
+	}
+	GLuint id = 0;
+	glGenTextures( 1, &id );
+	glBindTexture( GL_TEXTURE_2D, id );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, c->width, c->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	free( pixels );
+	if( !id || glGetError() != GL_NO_ERROR )
+	{
+		return EVRCompositorError_VRCompositorError_RequestFailed;
+	}
+	*texture = id;
+	*shared = (glSharedTextureHandle_t)(uintptr_t)id;
+	return EVRCompositorError_VRCompositorError_None;
+}
+
+static bool OPENVR_FNTABLE_CALLTYPE FakeReleaseSharedGLTexture( glUInt_t texture, glSharedTextureHandle_t shared )
+{
+	GLuint id = texture;
+	glDeleteTextures( 1, &id );
+	return true;
+}
+
+static void OPENVR_FNTABLE_CALLTYPE FakeLockGLSharedTextureForAccess( glSharedTextureHandle_t shared )
+{
+}
+
+static struct VR_IVRSystem_FnTable fakeSystem = {
+	.GetDeviceToAbsoluteTrackingPose = FakeGetDeviceToAbsoluteTrackingPose,
+	.GetTrackedDeviceActivityLevel = FakeGetTrackedDeviceActivityLevel,
+	.GetTrackedDeviceIndexForControllerRole = FakeGetTrackedDeviceIndexForControllerRole,
+	.IsTrackedDeviceConnected = FakeIsTrackedDeviceConnected,
+	.PollNextEvent = FakePollNextEvent,
+	.AcknowledgeQuit_Exiting = FakeAcknowledgeQuit_Exiting,
+};
+
+static struct VR_IVRApplications_FnTable fakeApplications = {
+	.AddApplicationManifest = FakeAddApplicationManifest,
+	.IsApplicationInstalled = FakeIsApplicationInstalled,
+	.GetApplicationsErrorNameFromEnum = FakeGetApplicationsErrorNameFromEnum,
+	.GetApplicationKeyByProcessId = FakeGetApplicationKeyByProcessId,
+	.GetCurrentSceneProcessId = FakeGetCurrentSceneProcessId,
+};
+
+static struct VR_IVRScreenshots_FnTable fakeScreenshots = {
+	.RequestScreenshot = FakeRequestScreenshot,
+	.HookScreenshot = FakeHookScreenshot,
+	.GetScreenshotPropertyFilename = FakeGetScreenshotPropertyFilename,
+	.TakeStereoScreenshot = FakeTakeStereoScreenshot,
+	.SubmitScreenshot = FakeSubmitScreenshot,
+};
+
+static struct VR_IVRCompositor_FnTable fakeCompositor = {
+	.GetFrameTimings = FakeGetFrameTimings,
+	.GetCumulativeStats = FakeGetCumulativeStats,
+	.GetMirrorTextureGL = FakeGetMirrorTextureGL,
+	.ReleaseSharedGLTexture = FakeReleaseSharedGLTexture,
+	.LockGLSharedTextureForAccess = FakeLockGLSharedTextureForAccess,
+	.UnlockGLSharedTextureForAccess = FakeLockGLSharedTextureForAccess,
+};
+
+// Entry points
+
+FAKE_API intptr_t VR_InitInternal( EVRInitError * err, EVRApplicationType type )
+{
+	struct FakeConfig * c = &fake.config;
+	c->latencyMs = FakeEnv( "FAKE_OPENVR_LATENCY_MS", 400 );
+	c->jitterMs = FakeEnv( "FAKE_OPENVR_JITTER_MS", 200 );
+	c->failRate = FakeEnv( "FAKE_OPENVR_FAIL_RATE", 0 );
+	c->busyRate = FakeEnv( "FAKE_OPENVR_BUSY_RATE", 0 );
+	c->width = FakeEnv( "FAKE_OPENVR_WIDTH", 1024 );
+	c->height = FakeEnv( "FAKE_OPENVR_HEIGHT", 1024 );
+	c->quitAfter = FakeEnv( "FAKE_OPENVR_QUIT_AFTER", 0 );
+	c->idle = FakeEnv( "FAKE_OPENVR_IDLE", 0 ) != 0;
+	c->noScene = FakeEnv( "FAKE_OPENVR_NO_SCENE", 0 ) != 0;
+	c->hookEvery = FakeEnv( "FAKE_OPENVR_HOOK_EVERY", 0 );
+	c->mirror = FakeEnv( "FAKE_OPENVR_MIRROR", 0 ) != 0;
+	fake.random = (uint64_t)FakeEnv( "FAKE_OPENVR_SEED", 1 ) * 0x9E3779B97F4A7C15ull | 1;
+	if( c->width < 1 ) c->width = 1;
+	if( c->height < 1 ) c->height = 1;
+
+	fake.started = OGGetAbsoluteTime();
+	fake.lock = OGCreateMutex();
+	fake.work = OGCreateSema();
+	fake.running = 1;
+	fake.writer = OGCreateThread( FakeWriter, NULL );
+	printf( "Fake OpenVR runtime: %d+%d ms per screenshot, %.0f%% fail, %.0f%% refused, %dx%d\n", c->latencyMs, c->jitterMs,
+		c->failRate * 100, c->busyRate * 100, c->width, c->height );
+	*err = EVRInitError_VRInitError_None;
+	return 1;
+}
+
+FAKE_API void VR_ShutdownInternal()
+{
+	if( !fake.running )
+	{
+		return;
+	}
+	fake.running = 0;
+	OGUnlockSema( fake.work );
+	OGJoinThread( fake.writer );
+	printf( "Fake OpenVR runtime: %lld requested, %lld refused, %lld taken, %lld failed, %lld asked for by the user, %lld submitted, %.1f MB written\n",
+		fake.requested, fake.refused, fake.taken, fake.failed, fake.hookRequests, fake.submitted, fake.bytesWritten / ( 1024 * 1024 ) );
+}
+
+FAKE_API bool VR_IsHmdPresent()
+{
+	return true;
+}
+
+FAKE_API bool VR_IsRuntimeInstalled()
+{
+	return true;
+}
+
+FAKE_API intptr_t VR_GetGenericInterface( const char * version, EVRInitError * err )
+{
+	const struct { const char * version; void * table; } tables[] = {
+		{ IVRSystem_Version, &fakeSystem },
+		{ IVRApplications_Version, &fakeApplications },
+		{ IVRScreenshots_Version, &fakeScreenshots },
+		{ IVRCompositor_Version, &fakeCompositor },
+	};
+	const char * name = strncmp( version, "FnTable:", 8 ) == 0 ? version + 8 : NULL;
+	for( int i = 0; name && i < sizeof( tables ) / sizeof( tables[0] ); i++ )
+	{
+		if( strcmp( name, tables[i].version ) == 0 )
+		{
+			*err = EVRInitError_VRInitError_None;
+			return (intptr_t)tables[i].table;
+		}
+	}
+	*err = EVRInitError_VRInitError_Init_InvalidInterface;
+	return 0;
+}
+
+FAKE_API const char * VR_GetVRInitErrorAsSymbol( EVRInitError error )
+{
+	return error ? "VRInitError_Init_InvalidInterface" : "VRInitError_None";
+}
+
+FAKE_API const char * VR_GetVRInitErrorAsEnglishDescription( EVRInitError error )
+{
+	return error ? "The fake runtime doesn't have that interface" : "No error";
+}
@@ -0,0 +1,376 @@
+#ifndef _PISS_CATALOG_H
+#define _PISS_CATALOG_H
+
+// The capture catalog. Every screenshot PISS asks for ends up as one fixed size record in
+// Screenshots\catalog.bin: when it was taken, its type, the files, their sizes and hash, the app
+// that was running and, if it didn't work, why not. Nothing in the catalog is ever changed once
+// it's written, records only get added on the end.
+//
+// Records go in the order the screenshots were asked for. Each keeps the time it was really
+// asked for, and a sort time that never goes backwards: if the clock is moved back, records
+// carry on with the last sort time until it catches up (and that includes the last one in the
+// file from before PISS was started), so the file is sorted by sort time. Every
+// CATALOG_INDEX_EVERY records, Screenshots\catalog.idx gets the sort time and number of that
+// record, so finding a time range means a binary search over a small
+// index and then reading at most that many records, however many years the catalog covers.
+//
+// Screenshots finish in whatever order they finish, so records wait in a small reorder ring until
+// everything asked for before them is done, and then go into a batch that a worker writes out,
+// the same as the sidecar records. Anything that still isn't done CATALOG_REORDER captures later
+// is written as unfinished rather than holding up everything after it.
+//
+// Records are little endian, and each starts with CATALOG_MAGIC and its own number and ends with
+// a seal worked out from the number. The seal is written last, so a reader that finds a record
+// without one at the end of the file is looking at a record still being written, and the writer
+// starts again after the last sealed record.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CATALOG_MAGIC 0x474c5443		// "CTLG"
+#define CATALOG_VERSION 2
+#define CATALOG_RECORD_SIZE 512
+#define CATALOG_SEAL 0x5349535343415421ull
+#define CATALOG_INDEX_EVERY 64
+#define CATALOG_BATCH 64
+#define CATALOG_REORDER 256
+
+// Errors of our own, past the end of EVRScreenshotError.
+enum CatalogError
+{
+	CatalogError_None = 0,
+	CatalogError_NotSaved = 1000,		// SteamVR said it failed, or never said anything
+	CatalogError_Missing = 1001,		// it said it was saved, but the files weren't there
+	CatalogError_Unfinished = 1002,		// PISS quit or gave up before it was done
+};
+
+struct CatalogRecord
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	uint64_t number;			// which record this is, counting from 0
+	int64_t time;				// unix time it was asked for
+	int64_t sortTime;			// time, or the record before's sortTime if that's later
+	int64_t scheduled;			// unix time it was due
+	int32_t type;				// EVRScreenshotType, or 6 for a mirror capture
+	int32_t error;				// EVRScreenshotError if SteamVR turned it down, or a CatalogError
+	uint32_t flags;				// SidecarFlags
+	uint32_t handle;
+	int64_t previewBytes;		// -1 if it doesn't have one
+	int64_t vrBytes;
+	uint64_t hash;				// FNV-1a over the preview and then the VR image, as in index.txt
+	char appKey[128];			// scene app, empty if there wasn't one
+	char preview[148];			// relative to the exe, or the name we asked for if it wasn't saved
+	char vr[148];
+	uint64_t seal;				// number ^ CATALOG_SEAL
+};
+
+_Static_assert( sizeof( struct CatalogRecord ) == CATALOG_RECORD_SIZE, "catalog records have a fixed layout" );
+_Static_assert( offsetof( struct CatalogRecord, seal ) == CATALOG_RECORD_SIZE - 8, "the seal is last" );
+
+// One of these in catalog.idx for every CATALOG_INDEX_EVERY records. Entry i is always for
+// record i * CATALOG_INDEX_EVERY.
+struct CatalogIndexEntry
+{
+	int64_t time;				// the record's sortTime
+	uint64_t number;
+};
+
+_Static_assert( sizeof( struct CatalogIndexEntry ) == 16, "index entries have a fixed layout" );
+
+struct CatalogBatch
+{
+	atomic_int writing;			// handed to a worker, leave it alone
+	int count;
+	double started;				// when the first record went in
+	struct CatalogRecord records[CATALOG_BATCH];
+};
+
+enum CatalogSlotState
+{
+	CatalogSlot_Free,
+	CatalogSlot_Pending,
+	CatalogSlot_Done,
+};
+
+struct CatalogSlot
+{
+	int state;
+	struct CatalogRecord record;
+};
+
+struct Catalog
+{
+	uint64_t next;				// the ticket the next capture gets, 0 is never used
+	uint64_t released;			// the oldest ticket still in the ring
+	uint64_t numbered;			// the number the next record released gets
+	int64_t lastTime;			// sortTime of the last record released, or the last in the file at startup
+	struct CatalogSlot slots[CATALOG_REORDER];
+	struct CatalogBatch batches[2];
+	int current;
+	long long unfinished;		// written out before they were done
+	long long dropped;			// the batches were full, so they never got written at all
+};
+
+
+static inline struct CatalogSlot * CatalogSlotFor( struct Catalog * c, uint64_t ticket )
+{
+	return &c->slots[ticket % CATALOG_REORDER];
+}
+
+// Moves everything at the front of the ring that's done into the current batch. Returns true
+// if the batch is full and should be written.
+static inline bool CatalogRelease( struct Catalog * c, double now )
+{
+	struct CatalogBatch * batch = &c->batches[c->current];
+	while( c->released < c->next && batch->count < CATALOG_BATCH )
+	{
+		struct CatalogSlot * slot = CatalogSlotFor( c, c->released );
+		if( slot->state != CatalogSlot_Done )
+		{
+			break;
+		}
+		// The clock went back, keep the real time but sort it after what's already there.
+		slot->record.sortTime = slot->record.time < c->lastTime ? c->lastTime : slot->record.time;
+		c->lastTime = slot->record.sortTime;
+		slot->record.number = c->numbered++;
+		slot->record.seal = slot->record.number ^ CATALOG_SEAL;
+		if( !batch->count )
+		{
+			batch->started = now;
+		}
+		batch->records[batch->count++] = slot->record;
+		slot->state = CatalogSlot_Free;
+		c->released++;
+	}
+	return batch->count == CATALOG_BATCH;
+}
+
+// Takes a ticket for a capture that's just been asked for, with everything known about it so
+// far. The ticket goes to CatalogFinish() once it's done. Never fails, if the ring is full the
+// oldest capture is pushed out (see the top of the file).
+static inline uint64_t CatalogReserve( struct Catalog * c, const struct CatalogRecord * r, double now )
+{
+	if( c->next - c->released == CATALOG_REORDER )
+	{
+		struct CatalogSlot * oldest = CatalogSlotFor( c, c->released );
+		if( oldest->state == CatalogSlot_Pending )
+		{
+			oldest->record.error = CatalogError_Unfinished;
+			oldest->state = CatalogSlot_Done;
+			c->unfinished++;
+		}
+		CatalogRelease( c, now );
+		if( c->next - c->released == CATALOG_REORDER )
+		{
+			oldest->state = CatalogSlot_Free;
+			c->released++;
+			c->dropped++;
+		}
+	}
+	uint64_t ticket = c->next++;
+	struct CatalogSlot * slot = CatalogSlotFor( c, ticket );
+	slot->record = *r;
+	slot->state = CatalogSlot_Pending;
+	return ticket;
+}
+
+// Marks a capture done, with the files it ended up as (NULL leaves the names it was asked for
+// with). Returns false if it was too late and has already been written out.
+static inline bool CatalogFinish( struct Catalog * c, uint64_t ticket, int error, const char * preview, const char * vr,
+	int64_t previewBytes, int64_t vrBytes, uint64_t hash )
+{
+	if( ticket < c->released || ticket >= c->next )
+	{
+		return false;
+	}
+	struct CatalogSlot * slot = CatalogSlotFor( c, ticket );
+	if( preview )
+	{
+		snprintf( slot->record.preview, sizeof( slot->record.preview ), "%s", preview );
+	}
+	if( vr )
+	{
+		snprintf( slot->record.vr, sizeof( slot->record.vr ), "%s", vr );
+	}
+	slot->record.error = error;
+	slot->record.previewBytes = previewBytes;
+	slot->record.vrBytes = vrBytes;
+	slot->record.hash = hash;
+	slot->state = CatalogSlot_Done;
+	return true;
+}
+
+// Marks everything still going as unfinished, for when PISS is about to quit.
+static inline void CatalogFinishAll( struct Catalog * c )
+{
+	for( uint64_t ticket = c->released; ticket < c->next; ticket++ )
+	{
+		struct CatalogSlot * slot = CatalogSlotFor( c, ticket );
+		if( slot->state == CatalogSlot_Pending )
+		{
+			slot->record.error = CatalogError_Unfinished;
+			slot->state = CatalogSlot_Done;
+			c->unfinished++;
+		}
+	}
+}
+
+// Hands back the current batch for writing and starts filling the other, or NULL if there's
+// nothing to write or the other is still being written.
+static inline struct CatalogBatch * CatalogTakeBatch( struct Catalog * c )
+{
+	struct CatalogBatch * batch = &c->batches[c->current];
+	if( !batch->count || atomic_load( &c->batches[!c->current].writing ) )
+	{
+		return NULL;
+	}
+	atomic_store( &batch->writing, 1 );
+	c->current = !c->current;
+	return batch;
+}
+
+static inline bool CatalogRecordSealed( const struct CatalogRecord * r, uint64_t number )
+{
+	return r->magic == CATALOG_MAGIC && r->number == number && r->seal == ( number ^ CATALOG_SEAL );
+}
+
+// Opens a file for writing somewhere in the middle, making it if it isn't there.
+static inline FILE * CatalogOpen( const char * path )
+{
+	FILE * f = fopen( path, "r+b" );
+	return f ? f : fopen( path, "w+b" );
+}
+
+// How many whole items of size are in f. Anything after the last whole one was cut off by a
+// crash, and gets written over by the next thing to go on the end.
+static inline long long CatalogCount( FILE * f, size_t size )
+{
+	if( fseek( f, 0, SEEK_END ) )
+	{
+		return -1;
+	}
+	long long length = ftell( f );
+	return length < 0 ? -1 : length / (long long)size;
+}
+
+// How many records at the start of the catalog are whole and sealed, with the last of them in
+// last. Anything after that was cut off or never finished, and gets written over.
+static inline long long CatalogSealedCount( FILE * f, struct CatalogRecord * last )
+{
+	long long count = CatalogCount( f, CATALOG_RECORD_SIZE );
+	while( count > 0 )
+	{
+		if( fseek( f, (long)( ( count - 1 ) * CATALOG_RECORD_SIZE ), SEEK_SET ) != 0 || fread( last, sizeof( *last ), 1, f ) != 1 )
+		{
+			return -1;
+		}
+		if( CatalogRecordSealed( last, (uint64_t)( count - 1 ) ) )
+		{
+			break;
+		}
+		count--;
+	}
+	return count;
+}
+
+// Picks up where the catalog on disk left off: records carry on numbering from the last sealed
+// one, and never sort before it, even if the clock was put back while PISS wasn't
+// running (see CatalogRelease()).
+static inline void CatalogStart( struct Catalog * c, const char * path )
+{
+	c->next = c->released = 1;
+	c->numbered = 0;
+	c->lastTime = 0;
+	FILE * f = fopen( path, "rb" );
+	if( f )
+	{
+		struct CatalogRecord last;
+		long long count = CatalogSealedCount( f, &last );
+		if( count > 0 )
+		{
+			c->numbered = (uint64_t)count;
+			c->lastTime = last.sortTime;
+		}
+		fclose( f );
+	}
+}
+
+// Writes index entries up to the one for the last record in the batch. Normally that's one
+// entry at most, but if PISS stopped between writing records and their entry, the missing ones
+// are read back out of the catalog.
+static inline bool CatalogWriteIndex( FILE * catalog, const char * indexPath, long long first, const struct CatalogBatch * b )
+{
+	FILE * f = CatalogOpen( indexPath );
+	if( !f )
+	{
+		return false;
+	}
+	long long have = CatalogCount( f, sizeof( struct CatalogIndexEntry ) );
+	long long want = ( first + b->count - 1 ) / CATALOG_INDEX_EVERY + 1;
+	// Entries for records that have just been written over are no good either.
+	long long kept = ( first + CATALOG_INDEX_EVERY - 1 ) / CATALOG_INDEX_EVERY;
+	if( have > kept )
+	{
+		have = kept;
+	}
+	bool ok = have >= 0 && fseek( f, have * (long long)sizeof( struct CatalogIndexEntry ), SEEK_SET ) == 0;
+	for( long long e = have; e < want && ok; e++ )
+	{
+		struct CatalogIndexEntry entry;
+		entry.number = (uint64_t)e * CATALOG_INDEX_EVERY;
+		if( (long long)entry.number >= first )
+		{
+			entry.time = b->records[entry.number - first].sortTime;
+		}
+		else
+		{
+			ok = fseek( catalog, (long)( entry.number * CATALOG_RECORD_SIZE + offsetof( struct CatalogRecord, sortTime ) ), SEEK_SET ) == 0 &&
+				fread( &entry.time, sizeof( entry.time ), 1, catalog ) == 1;
+		}
+		ok = ok && fwrite( &entry, sizeof( entry ), 1, f ) == 1;
+	}
+	return fclose( f ) == 0 && ok;
+}
+
+// Adds a batch to the end of the catalog and its index, and hands it back empty. Returns false
+// if it couldn't be written. Only one batch is ever written at a time. Offsets are longs, which
+// on Windows caps the catalog at 2 GB, a little over four million captures.
+static inline bool CatalogWrite( struct CatalogBatch * b, const char * path, const char * indexPath )
+{
+	if( !b->count )
+	{
+		atomic_store( &b->writing, 0 );
+		return true;
+	}
+	bool ok = false;
+	FILE * f = CatalogOpen( path );
+	if( f )
+	{
+		struct CatalogRecord last;
+		long long first = CatalogSealedCount( f, &last );
+		if( first >= 0 && fseek( f, (long)( first * CATALOG_RECORD_SIZE ), SEEK_SET ) == 0 )
+		{
+			// Normally the records are already numbered from here, unless an earlier batch
+			// couldn't be written or something else has been adding to the catalog.
+			for( int i = 0; i < b->count; i++ )
+			{
+				b->records[i].number = (uint64_t)( first + i );
+				b->records[i].seal = b->records[i].number ^ CATALOG_SEAL;
+			}
+			ok = fwrite( b->records, sizeof( b->records[0] ), b->count, f ) == (size_t)b->count && fflush( f ) == 0;
+			ok = ok && CatalogWriteIndex( f, indexPath, first, b );
+		}
+		ok = fclose( f ) == 0 && ok;
+	}
+	b->count = 0;
+	atomic_store( &b->writing, 0 );
+	return ok;
+}
+
+#endif
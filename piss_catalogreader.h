@@ -0,0 +1,193 @@
+#ifndef _PISS_CATALOGREADER_H
+#define _PISS_CATALOGREADER_H
+
+// Reading the capture catalog (see piss_catalog.h) in place. The catalog and its index are
+// mapped into memory and searched right there, nothing is parsed, copied or allocated, so a
+// query over years of captures is a couple of binary searches and then a walk over whatever
+// matched.
+//
+// PISS can be adding to the catalog while it's being read. A reader sees the catalog as it was
+// when it was opened (or last refreshed): records are never changed once they're written, so
+// anything in the view stays good, and anything added after just isn't in it yet. The only
+// record that can be half written is the last one, which won't have its seal yet, so it's left
+// out until a later refresh. The index goes the same way, it's written after the records, and
+// the search falls back to the records themselves for any part of the catalog the index
+// doesn't cover yet.
+//
+// Needs piss_platform.h and piss_catalog.h included first.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+struct CatalogReader
+{
+	const char * path;
+	const char * indexPath;
+	struct PlatformMap records;
+	struct PlatformMap index;
+	const struct CatalogRecord * r;
+	uint64_t count;				// sealed records in the view
+	const struct CatalogIndexEntry * entries;
+	uint64_t entryCount;		// index entries for records in the view
+};
+
+// What to look for. Anything zero (or -1 for type) matches everything.
+struct CatalogQuery
+{
+	int64_t from;				// unix times, from <= sortTime < to
+	int64_t to;
+	const char * app;			// exact app key
+	int type;					// EVRScreenshotType, 6 for mirror, or -1
+};
+
+// Works out how much of the mapped files can be trusted.
+static inline void CatalogReaderCheck( struct CatalogReader * c )
+{
+	c->r = c->records.data;
+	c->count = c->records.size / CATALOG_RECORD_SIZE;
+	while( c->count && !CatalogRecordSealed( &c->r[c->count - 1], c->count - 1 ) )
+	{
+		c->count--;
+	}
+
+	// Entries only go in after their records, and are never changed after, so it's only the last
+	// few that can be for records not in the view yet, or cut off part way.
+	c->entries = c->index.data;
+	c->entryCount = c->index.size / sizeof( struct CatalogIndexEntry );
+	uint64_t covered = ( c->count + CATALOG_INDEX_EVERY - 1 ) / CATALOG_INDEX_EVERY;
+	if( c->entryCount > covered )
+	{
+		c->entryCount = covered;
+	}
+	while( c->entryCount )
+	{
+		const struct CatalogIndexEntry * e = &c->entries[c->entryCount - 1];
+		if( e->number == ( c->entryCount - 1 ) * CATALOG_INDEX_EVERY && c->r[e->number].sortTime == e->time )
+		{
+			break;
+		}
+		c->entryCount--;
+	}
+}
+
+// Maps the catalog as it is now. A catalog that isn't there yet opens fine and is just empty.
+static inline bool CatalogReaderOpen( struct CatalogReader * c, const char * path, const char * indexPath )
+{
+	memset( c, 0, sizeof( *c ) );
+	c->path = path;
+	c->indexPath = indexPath;
+	PlatformMapFile( &c->records, path );
+	PlatformMapFile( &c->index, indexPath );
+	CatalogReaderCheck( c );
+	return true;
+}
+
+static inline void CatalogReaderClose( struct CatalogReader * c )
+{
+	PlatformUnmapFile( &c->records );
+	PlatformUnmapFile( &c->index );
+	c->r = NULL;
+	c->entries = NULL;
+	c->count = c->entryCount = 0;
+}
+
+// Maps the catalog again if it's grown. Returns true if there's anything new. Pointers to
+// records from before are no good afterwards.
+static inline bool CatalogReaderRefresh( struct CatalogReader * c )
+{
+	struct PlatformMap records, index;
+	if( !PlatformMapFile( &records, c->path ) )
+	{
+		return false;
+	}
+	PlatformMapFile( &index, c->indexPath );
+	if( records.size == c->records.size && index.size == c->index.size )
+	{
+		PlatformUnmapFile( &records );
+		PlatformUnmapFile( &index );
+		return false;
+	}
+	uint64_t before = c->count;
+	PlatformUnmapFile( &c->records );
+	PlatformUnmapFile( &c->index );
+	c->records = records;
+	c->index = index;
+	CatalogReaderCheck( c );
+	return c->count > before;
+}
+
+// The first record whose sortTime is at or after time. Narrows it down to one stretch of CATALOG_INDEX_EVERY
+// records with the index, then searches the records in that stretch.
+static inline uint64_t CatalogReaderFind( const struct CatalogReader * c, int64_t time )
+{
+	uint64_t lo = 0, hi = c->entryCount;
+	while( lo < hi )
+	{
+		uint64_t mid = lo + ( hi - lo ) / 2;
+		if( c->entries[mid].time < time )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	// Entry lo is the first at or after time, so the answer is somewhere after the entry before it.
+	uint64_t first = lo ? c->entries[lo - 1].number : 0;
+	uint64_t last = lo < c->entryCount ? c->entries[lo].number : c->count;
+	while( first < last )
+	{
+		uint64_t mid = first + ( last - first ) / 2;
+		if( c->r[mid].sortTime < time )
+		{
+			first = mid + 1;
+		}
+		else
+		{
+			last = mid;
+		}
+	}
+	return first;
+}
+
+static inline bool CatalogQueryMatches( const struct CatalogQuery * q, const struct CatalogRecord * r )
+{
+	if( q->type >= 0 && r->type != q->type )
+	{
+		return false;
+	}
+	if( q->app && q->app[0] && strncmp( r->appKey, q->app, sizeof( r->appKey ) ) != 0 )
+	{
+		return false;
+	}
+	return true;
+}
+
+// Where a query's records start, for CatalogQueryNext().
+static inline uint64_t CatalogQueryStart( const struct CatalogReader * c, const struct CatalogQuery * q )
+{
+	return q->from ? CatalogReaderFind( c, q->from ) : 0;
+}
+
+// The next record from *at on that matches, or NULL once there are no more.
+static inline const struct CatalogRecord * CatalogQueryNext( const struct CatalogReader * c, const struct CatalogQuery * q, uint64_t * at )
+{
+	while( *at < c->count )
+	{
+		const struct CatalogRecord * r = &c->r[( *at )++];
+		if( q->to && r->sortTime >= q->to )
+		{
+			*at = c->count;
+			return NULL;
+		}
+		if( CatalogQueryMatches( q, r ) )
+		{
+			return r;
+		}
+	}
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _PISS_CLOCK_H
+#define _PISS_CLOCK_H
+
+// Keeps an eye on the wall clock. Capture times are wall clock times, but the wall clock can
+// be moved (NTP corrections, someone changing the time) and the machine can be put to sleep,
+// both of which make a wait end somewhere we didn't expect. We remember both the wall clock and
+// a monotonic clock (OGGetAbsoluteTime()) each time we check, and compare how far each moved.
+//
+// Like the schedule, this never reads a clock itself, it's handed the times to compare.
+
+#include <time.h>
+
+enum ClockChange
+{
+	ClockChange_None,
+	ClockChange_Jump,		// the wall clock moved by a different amount than the monotonic clock
+	ClockChange_Resume,		// both clocks agree, but we woke up long after we asked to
+};
+
+enum MissedCapturePolicy
+{
+	MissedCapture_FireOnce,		// one screenshot covers everything that was missed
+	MissedCapture_FireAll,		// one screenshot for every capture that was missed
+	MissedCapture_Skip,			// forget about them and carry on with the next one
+};
+
+struct ClockWatch
+{
+	time_t wall;			// wall clock at the last check
+	double mono;			// monotonic clock at the last check
+	double jumpTolerance;	// seconds the two may drift apart between checks before it counts as a jump
+	double lateTolerance;	// seconds past a deadline before we decide we weren't running
+	double lastChange;		// seconds the wall clock jumped (forward is positive), or how late the resume was
+	int jumps;
+	int resumes;
+};
+
+static inline void ClockWatchStart( struct ClockWatch * cw, time_t wall, double mono )
+{
+	cw->wall = wall;
+	cw->mono = mono;
+	cw->lastChange = 0;
+}
+
+// Compares the time now against the last check. Deadline is what we were waiting for, or 0.
+static inline int ClockWatchCheck( struct ClockWatch * cw, time_t wall, double mono, time_t deadline )
+{
+	int change = ClockChange_None;
+
+	// The wall clock only has whole seconds, so small differences here are just rounding.
+	double skew = difftime( wall, cw->wall ) - ( mono - cw->mono );
+	if( skew > cw->jumpTolerance || skew < -cw->jumpTolerance )
+	{
+		// If the monotonic clock stops while the machine sleeps this will also catch resumes, which
+		// is fine, the two are handled the same way once we're past a deadline.
+		change = ClockChange_Jump;
+		cw->lastChange = skew;
+		cw->jumps++;
+	}
+	else if( deadline && difftime( wall, deadline ) > cw->lateTolerance )
+	{
+		change = ClockChange_Resume;
+		cw->lastChange = difftime( wall, deadline );
+		cw->resumes++;
+	}
+
+	cw->wall = wall;
+	cw->mono = mono;
+	return change;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _PISS_FOLDERS_H
+#define _PISS_FOLDERS_H
+
+// Remembers which folders we know are there, so a screenshot only asks Windows to make its
+// folders when the name moves into a new one (a new month with the default file_names, or
+// whatever the template splits on). Every other capture makes no calls at all.
+//
+// Folders are remembered by a hash of their path, a handful at a time, oldest forgotten first.
+// Whoever owns the cache has to clear it when a folder might have gone away underneath us (see
+// FoldersForget()), after which the next capture makes its folders again.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FOLDERS_KNOWN 16
+
+// Makes one folder. Should return true if it's there afterwards, including if it already was.
+typedef bool (*FolderMakeFn)( const char * path );
+
+struct Folders
+{
+	uint64_t known[FOLDERS_KNOWN];
+	int count;
+	int next;						// the slot to reuse when they're all taken
+	long long made;					// calls to make a folder
+	long long forgotten;			// times the cache was cleared
+};
+
+static inline uint64_t FoldersHash( const char * path, size_t length )
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	for( size_t i = 0; i < length; i++ )
+	{
+		h = ( h ^ (unsigned char)path[i] ) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+static inline bool FoldersKnow( const struct Folders * f, uint64_t h )
+{
+	for( int i = 0; i < f->count; i++ )
+	{
+		if( f->known[i] == h )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline void FoldersForget( struct Folders * f )
+{
+	f->count = 0;
+	f->next = 0;
+	f->forgotten++;
+}
+
+// Makes every folder in path after the first skip characters that we don't already know about.
+// The last part of path is the file name and is left alone. Returns false if one couldn't be made.
+static inline bool FoldersMake( struct Folders * f, char * path, size_t skip, FolderMakeFn make )
+{
+	for( char * c = path + skip; *c; c++ )
+	{
+		if( *c != '\\' && *c != '/' )
+		{
+			continue;
+		}
+		uint64_t h = FoldersHash( path, c - path );
+		if( FoldersKnow( f, h ) )
+		{
+			continue;
+		}
+		char separator = *c;
+		*c = 0;
+		bool ok = make( path );
+		*c = separator;
+		f->made++;
+		if( !ok )
+		{
+			return false;
+		}
+		if( f->count < FOLDERS_KNOWN )
+		{
+			f->known[f->count++] = h;
+		}
+		else
+		{
+			f->known[f->next] = h;
+			f->next = ( f->next + 1 ) % FOLDERS_KNOWN;
+		}
+	}
+	return true;
+}
+
+#endif
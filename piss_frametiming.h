@@ -0,0 +1,96 @@
+#ifndef _PISS_FRAMETIMING_H
+#define _PISS_FRAMETIMING_H
+
+// Works out from the compositor's frame timings whether now is a good moment to ask for a
+// screenshot, and afterwards how many frames the screenshot cost. Reading the frame timings
+// is left to the caller, these functions just look at what they're given.
+//
+// Needs openvr_capi.h included first.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bits of Compositor_FrameTiming::m_nReprojectionFlags that mean a frame had to be reprojected
+// because the app ran out of time (VRCompositor_ReprojectionReason_Cpu and _Gpu in openvr.h).
+// The other bits just say which kind of reprojection is turned on.
+#define FRAME_REPROJECTION_REASONS 0x03
+
+#define FRAME_TIMING_HISTORY 90
+
+// Dropped and reprojected frames per presented frame, over some recent run of frames.
+struct FrameRates
+{
+	double dropped;
+	double reprojected;
+};
+
+// Extra frames captures have cost on top of what the app was dropping anyway.
+struct FrameCost
+{
+	int captures;
+	double extraDropped;
+	double extraReprojected;
+};
+
+static inline bool FrameTimingBad( const Compositor_FrameTiming * t )
+{
+	return t->m_nNumDroppedFrames || t->m_nNumMisPresented || ( t->m_nReprojectionFlags & FRAME_REPROJECTION_REASONS );
+}
+
+// True if none of the newest `frames` frames were dropped, mispresented or reprojected. Timings
+// are in the order GetFrameTimings gives them, oldest first.
+static inline bool FrameTimingsStable( const Compositor_FrameTiming * timings, int count, int frames )
+{
+	if( count < frames )
+	{
+		return false;
+	}
+	for( int i = count - frames; i < count; i++ )
+	{
+		if( FrameTimingBad( &timings[i] ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline struct FrameRates FrameTimingsRates( const Compositor_FrameTiming * timings, int count )
+{
+	struct FrameRates r = { 0, 0 };
+	if( count <= 0 )
+	{
+		return r;
+	}
+	for( int i = 0; i < count; i++ )
+	{
+		r.dropped += timings[i].m_nNumDroppedFrames;
+		if( timings[i].m_nReprojectionFlags & FRAME_REPROJECTION_REASONS )
+		{
+			r.reprojected++;
+		}
+	}
+	r.dropped /= count;
+	r.reprojected /= count;
+	return r;
+}
+
+// Adds up what a capture cost between two snapshots of the cumulative stats, given how often
+// frames were being dropped or reprojected just before it. Returns the extra for this capture.
+static inline struct FrameCost FrameCostAdd( struct FrameCost * total, const Compositor_CumulativeStats * before,
+	const Compositor_CumulativeStats * after, struct FrameRates baseline )
+{
+	struct FrameCost c = { 1, 0, 0 };
+	if( after->m_nPid == before->m_nPid )
+	{
+		double presents = (double)( after->m_nNumFramePresents - before->m_nNumFramePresents );
+		c.extraDropped = (double)( after->m_nNumDroppedFrames - before->m_nNumDroppedFrames ) - baseline.dropped * presents;
+		c.extraReprojected = (double)( after->m_nNumReprojectedFrames - before->m_nNumReprojectedFrames ) - baseline.reprojected * presents;
+	}
+	total->captures++;
+	total->extraDropped += c.extraDropped;
+	total->extraReprojected += c.extraReprojected;
+	return c;
+}
+
+#endif
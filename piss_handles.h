@@ -0,0 +1,197 @@
+#ifndef _PISS_HANDLES_H
+#define _PISS_HANDLES_H
+
+// The table of screenshots we've asked SteamVR for and haven't heard back about yet. Each entry
+// is keyed by the ScreenshotHandle_t TakeStereoScreenshot gave us and holds everything we knew
+// about the request when we made it. When VREvent_ScreenshotTaken or VREvent_ScreenshotFailed
+// comes in for a handle, the entry is resolved: every registered completion handler is called
+// with it, in the order they were added, and then it's removed. That's the point where the
+// files are known to exist, so anything that works on them hangs off a completion handler
+// rather than polling the disk.
+//
+// Post-processing works on the entry itself rather than a copy, so a handler that hands it to a
+// worker holds it with HandleTableHold(), and it isn't used for another screenshot until every
+// hold is let go.
+//
+// SteamVR only works on one screenshot at a time, so the table is small and searched directly.
+//
+// Needs openvr_capi.h, piss_frametiming.h and piss_sidecar.h included first.
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _MAX_PATH
+#define _MAX_PATH 260
+#endif
+
+#define HANDLE_TABLE_SIZE 32		// screenshots waiting on SteamVR, and ones still being post-processed
+#define MAX_COMPLETION_HANDLERS 12
+
+// One screenshot we want: which capture it's for, what kind, and how it's being taken.
+struct CaptureRequest
+{
+	time_t scheduled;			// when the capture was due
+	int type;					// EVRScreenshotType
+	int shot;					// which screenshot of a burst it is
+	int attempt;				// 0 the first time it's asked for, then counts retries
+	bool gated;					// whether we waited for calm frame timings first
+	bool catchUp;				// making up for a capture that was missed
+	bool manual;				// the user asked for it through SteamVR, see hook_screenshots
+	ScreenshotHandle_t hookHandle;	// SteamVR's handle for a manual one, to hand the files back to
+};
+
+struct PendingCapture
+{
+	ScreenshotHandle_t handle;
+	struct CaptureRequest request;
+	bool late;					// a catch-up, retry or later burst shot, which would swamp the latency numbers
+	double noticed;				// wall clock when the loop woke up for it
+	double returned;			// wall clock when the screenshot call returned
+	double resolved;			// wall clock when we heard back, filled in just before the handlers run
+	Compositor_CumulativeStats statsBefore;
+	struct FrameRates baseline;
+	char path[_MAX_PATH];		// what we asked SteamVR to save to, without the extension
+	char pathvr[_MAX_PATH];
+	char previewFile[_MAX_PATH];	// the files SteamVR actually wrote, filled in when it's saved
+	char vrFile[_MAX_PATH];
+	struct SidecarRecord context;	// poses, app and frame timing when it was taken
+	uint64_t catalogTicket;		// its place in the catalog, 0 if it doesn't have one
+	int holds;					// post-capture jobs still using it
+};
+
+typedef void (*CaptureCompletionFn)( struct PendingCapture * pc, bool ok );
+
+struct HandleTable
+{
+	struct PendingCapture entries[HANDLE_TABLE_SIZE];
+	int count;					// waiting on SteamVR, not counting ones only held
+	CaptureCompletionFn handlers[MAX_COMPLETION_HANDLERS];
+	int handlerCount;
+};
+
+static inline void HandleTableOnComplete( struct HandleTable * t, CaptureCompletionFn fn )
+{
+	if( t->handlerCount < MAX_COMPLETION_HANDLERS )
+	{
+		t->handlers[t->handlerCount++] = fn;
+	}
+}
+
+static inline struct PendingCapture * HandleTableFind( struct HandleTable * t, ScreenshotHandle_t handle )
+{
+	if( handle == k_unScreenshotHandleInvalid )
+	{
+		return NULL;
+	}
+	for( int i = 0; i < HANDLE_TABLE_SIZE; i++ )
+	{
+		if( t->entries[i].handle == handle )
+		{
+			return &t->entries[i];
+		}
+	}
+	return NULL;
+}
+
+// Calls the completion handlers for an entry and takes it out of the table.
+static inline void HandleTableResolveEntry( struct HandleTable * t, struct PendingCapture * pc, bool ok, double now )
+{
+	pc->resolved = now;
+	for( int i = 0; i < t->handlerCount; i++ )
+	{
+		t->handlers[i]( pc, ok );
+	}
+	pc->handle = k_unScreenshotHandleInvalid;
+	t->count--;
+}
+
+// Resolves the entry for handle. Returns false if it isn't one of ours.
+static inline bool HandleTableResolve( struct HandleTable * t, ScreenshotHandle_t handle, bool ok, double now )
+{
+	struct PendingCapture * pc = HandleTableFind( t, handle );
+	if( !pc )
+	{
+		return false;
+	}
+	HandleTableResolveEntry( t, pc, ok, now );
+	return true;
+}
+
+// Keeps a resolved entry from being reused until HandleTableLetGo().
+static inline void HandleTableHold( struct PendingCapture * pc )
+{
+	pc->holds++;
+}
+
+static inline void HandleTableLetGo( struct PendingCapture * pc )
+{
+	pc->holds--;
+}
+
+// Whether HandleTableAdd() has anywhere to put another screenshot, free or one it can push out.
+static inline bool HandleTableHasRoom( const struct HandleTable * t )
+{
+	for( int i = 0; i < HANDLE_TABLE_SIZE; i++ )
+	{
+		if( !t->entries[i].holds )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Adds an entry for a new handle and returns it for the caller to fill in. If the table is
+// somehow full the oldest entry still waiting on SteamVR is resolved as failed to make room,
+// and if every entry is held it returns NULL (check HandleTableHasRoom() first).
+static inline struct PendingCapture * HandleTableAdd( struct HandleTable * t, ScreenshotHandle_t handle, double now )
+{
+	struct PendingCapture * slot = NULL;
+	for( int i = 0; i < HANDLE_TABLE_SIZE; i++ )
+	{
+		struct PendingCapture * e = &t->entries[i];
+		if( e->holds )
+		{
+			continue;
+		}
+		if( !e->handle )
+		{
+			slot = e;
+			break;
+		}
+		if( !slot || e->returned < slot->returned )
+		{
+			slot = e;
+		}
+	}
+	if( !slot )
+	{
+		return NULL;
+	}
+	if( slot->handle )
+	{
+		HandleTableResolveEntry( t, slot, false, now );
+	}
+	memset( slot, 0, sizeof( *slot ) );
+	slot->handle = handle;
+	t->count++;
+	return slot;
+}
+
+// Resolves as failed anything we've been waiting on for longer than timeout seconds. Returns how many.
+static inline int HandleTableExpire( struct HandleTable * t, double now, double timeout )
+{
+	int expired = 0;
+	for( int i = 0; i < HANDLE_TABLE_SIZE; i++ )
+	{
+		if( t->entries[i].handle && now - t->entries[i].returned > timeout )
+		{
+			HandleTableResolveEntry( t, &t->entries[i], false, now );
+			expired++;
+		}
+	}
+	return expired;
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef _PISS_MIRROR_H
+#define _PISS_MIRROR_H
+
+// A cheap mono capture straight from the compositor's mirror texture. A stereo screenshot makes
+// the compositor render and encode both eyes at full size, which is a lot to ask every few
+// seconds. The mirror texture is the left eye the compositor has already rendered, so all this
+// costs is a copy on the GPU.
+//
+// The copy goes into a pixel buffer object with a fence after it, so nothing waits on the GPU:
+// MirrorRead() queues the copy and returns straight away, and MirrorPoll() picks up any copy
+// whose fence has passed, maps it and takes the pixels. A few slots are kept so a new capture
+// can start while the last one is still being saved. A timer query around the copy says how
+// much GPU time it took.
+//
+// A copy can also be shrunk on the way (the replay's small frames), by blitting the texture into
+// a smaller one with linear filtering first, so only the small frame ever comes back to the CPU.
+// That needs framebuffer objects; without them the full size frame comes back and it's left to
+// the caller to shrink it.
+//
+// Everything here has to run on the thread that owns the GL context. Needs rawdraw_sf.h (with
+// CNFGOGL) and openvr_capi.h included first.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIRROR_SLOTS 3
+
+// Windows only ships the GL 1.1 headers, so anything newer is defined and looked up by hand.
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#endif
+#ifndef GL_DRAW_FRAMEBUFFER
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+
+struct MirrorGL
+{
+	void (APIENTRY * GenBuffers)( GLsizei n, GLuint * buffers );
+	void (APIENTRY * BindBuffer)( GLenum target, GLuint buffer );
+	void (APIENTRY * BufferData)( GLenum target, ptrdiff_t size, const void * data, GLenum usage );
+	void * (APIENTRY * MapBuffer)( GLenum target, GLenum access );
+	GLboolean (APIENTRY * UnmapBuffer)( GLenum target );
+	void * (APIENTRY * FenceSync)( GLenum condition, GLbitfield flags );
+	GLenum (APIENTRY * ClientWaitSync)( void * sync, GLbitfield flags, uint64_t timeout );
+	void (APIENTRY * DeleteSync)( void * sync );
+	void (APIENTRY * GenQueries)( GLsizei n, GLuint * ids );
+	void (APIENTRY * BeginQuery)( GLenum target, GLuint id );
+	void (APIENTRY * EndQuery)( GLenum target );
+	void (APIENTRY * GetQueryObjectui64v)( GLuint id, GLenum pname, uint64_t * params );
+};
+
+// Only needed to shrink copies on the GPU.
+struct MirrorFramebufferGL
+{
+	void (APIENTRY * GenFramebuffers)( GLsizei n, GLuint * ids );
+	void (APIENTRY * BindFramebuffer)( GLenum target, GLuint id );
+	void (APIENTRY * FramebufferTexture2D)( GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level );
+	void (APIENTRY * BlitFramebuffer)( GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1,
+		GLbitfield mask, GLenum filter );
+};
+
+enum MirrorSlotState
+{
+	MirrorSlot_Free,
+	MirrorSlot_Reading,		// copy queued on the GPU
+	MirrorSlot_Saving,		// pixels are in memory, waiting to be written out
+};
+
+struct MirrorSlot
+{
+	atomic_int state;
+	uint32_t handle;			// what the rest of PISS knows this capture as
+	GLuint buffer;
+	GLuint query;
+	void * fence;
+	int width;
+	int height;
+	int scale;					// how much the GPU shrank it each way
+	unsigned char * pixels;		// BGRA, bottom row first
+	size_t capacity;
+	double cpuSeconds;			// time spent on our side, queueing the copy and taking the pixels
+	double gpuSeconds;
+};
+
+struct Mirror
+{
+	bool ready;
+	struct MirrorGL gl;
+	glUInt_t texture;
+	glSharedTextureHandle_t shared;
+	struct MirrorSlot slots[MIRROR_SLOTS];
+	bool canShrink;
+	struct MirrorFramebufferGL fb;
+	GLuint readFramebuffer;		// the mirror texture, to blit from
+	GLuint smallFramebuffer;	// smallTexture, to blit to and read back
+	GLuint smallTexture;
+	int smallWidth;
+	int smallHeight;
+};
+
+// Looks up the GL functions and gets the mirror texture. A GL context has to be current.
+static inline bool MirrorStart( struct Mirror * m, struct VR_IVRCompositor_FnTable * compositor )
+{
+	struct MirrorGL * gl = &m->gl;
+	gl->GenBuffers = CNFGGetProcAddress( "glGenBuffers" );
+	gl->BindBuffer = CNFGGetProcAddress( "glBindBuffer" );
+	gl->BufferData = CNFGGetProcAddress( "glBufferData" );
+	gl->MapBuffer = CNFGGetProcAddress( "glMapBuffer" );
+	gl->UnmapBuffer = CNFGGetProcAddress( "glUnmapBuffer" );
+	gl->FenceSync = CNFGGetProcAddress( "glFenceSync" );
+	gl->ClientWaitSync = CNFGGetProcAddress( "glClientWaitSync" );
+	gl->DeleteSync = CNFGGetProcAddress( "glDeleteSync" );
+	gl->GenQueries = CNFGGetProcAddress( "glGenQueries" );
+	gl->BeginQuery = CNFGGetProcAddress( "glBeginQuery" );
+	gl->EndQuery = CNFGGetProcAddress( "glEndQuery" );
+	gl->GetQueryObjectui64v = CNFGGetProcAddress( "glGetQueryObjectui64v" );
+	void ** fns = (void **)gl;
+	for( int i = 0; i < sizeof( *gl ) / sizeof( void * ); i++ )
+	{
+		if( !fns[i] )
+		{
+			return false;
+		}
+	}
+
+	if( compositor->GetMirrorTextureGL( EVREye_Eye_Left, &m->texture, &m->shared ) != EVRCompositorError_VRCompositorError_None )
+	{
+		return false;
+	}
+
+	struct MirrorFramebufferGL * fb = &m->fb;
+	fb->GenFramebuffers = CNFGGetProcAddress( "glGenFramebuffers" );
+	fb->BindFramebuffer = CNFGGetProcAddress( "glBindFramebuffer" );
+	fb->FramebufferTexture2D = CNFGGetProcAddress( "glFramebufferTexture2D" );
+	fb->BlitFramebuffer = CNFGGetProcAddress( "glBlitFramebuffer" );
+	m->canShrink = fb->GenFramebuffers && fb->BindFramebuffer && fb->FramebufferTexture2D && fb->BlitFramebuffer;
+	if( m->canShrink )
+	{
+		fb->GenFramebuffers( 1, &m->readFramebuffer );
+		fb->GenFramebuffers( 1, &m->smallFramebuffer );
+		glGenTextures( 1, &m->smallTexture );
+		m->smallWidth = m->smallHeight = 0;
+	}
+	for( int i = 0; i < MIRROR_SLOTS; i++ )
+	{
+		struct MirrorSlot * s = &m->slots[i];
+		gl->GenBuffers( 1, &s->buffer );
+		gl->GenQueries( 1, &s->query );
+		atomic_store( &s->state, MirrorSlot_Free );
+	}
+	m->ready = true;
+	return true;
+}
+
+static inline void MirrorStop( struct Mirror * m, struct VR_IVRCompositor_FnTable * compositor )
+{
+	if( m->ready )
+	{
+		compositor->ReleaseSharedGLTexture( m->texture, m->shared );
+		m->ready = false;
+	}
+}
+
+// Blits the mirror texture, bound to GL_TEXTURE_2D, down to width x height and leaves the result
+// bound for reading.
+static inline void MirrorShrink( struct Mirror * m, int fullWidth, int fullHeight, int width, int height )
+{
+	struct MirrorFramebufferGL * fb = &m->fb;
+	if( width != m->smallWidth || height != m->smallHeight )
+	{
+		glBindTexture( GL_TEXTURE_2D, m->smallTexture );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL );
+		fb->BindFramebuffer( GL_DRAW_FRAMEBUFFER, m->smallFramebuffer );
+		fb->FramebufferTexture2D( GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m->smallTexture, 0 );
+		glBindTexture( GL_TEXTURE_2D, m->texture );
+		m->smallWidth = width;
+		m->smallHeight = height;
+	}
+	fb->BindFramebuffer( GL_READ_FRAMEBUFFER, m->readFramebuffer );
+	fb->FramebufferTexture2D( GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m->texture, 0 );
+	fb->BindFramebuffer( GL_DRAW_FRAMEBUFFER, m->smallFramebuffer );
+	fb->BlitFramebuffer( 0, 0, fullWidth, fullHeight, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR );
+	fb->BindFramebuffer( GL_DRAW_FRAMEBUFFER, 0 );
+	fb->BindFramebuffer( GL_READ_FRAMEBUFFER, m->smallFramebuffer );
+}
+
+// Queues a copy of the mirror texture, shrunk by scale each way if the GPU can do it (see
+// slot->scale for whether it did). Returns the slot it's going into, or NULL if every slot is
+// still busy.
+static inline struct MirrorSlot * MirrorRead( struct Mirror * m, struct VR_IVRCompositor_FnTable * compositor, uint32_t handle, int scale )
+{
+	struct MirrorSlot * s = NULL;
+	for( int i = 0; i < MIRROR_SLOTS && !s; i++ )
+	{
+		if( atomic_load( &m->slots[i].state ) == MirrorSlot_Free )
+		{
+			s = &m->slots[i];
+		}
+	}
+	if( !m->ready || !s )
+	{
+		return NULL;
+	}
+
+	double start = OGGetAbsoluteTime();
+	struct MirrorGL * gl = &m->gl;
+	compositor->LockGLSharedTextureForAccess( m->shared );
+	glBindTexture( GL_TEXTURE_2D, m->texture );
+	GLint width = 0, height = 0;
+	glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width );
+	glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height );
+	bool shrink = scale > 1 && m->canShrink && width / scale > 0 && height / scale > 0;
+	int fullWidth = width, fullHeight = height;
+	if( shrink )
+	{
+		width /= scale;
+		height /= scale;
+	}
+	gl->BindBuffer( GL_PIXEL_PACK_BUFFER, s->buffer );
+	gl->BufferData( GL_PIXEL_PACK_BUFFER, (ptrdiff_t)width * height * 4, NULL, GL_STREAM_READ );
+	gl->BeginQuery( GL_TIME_ELAPSED, s->query );
+	if( shrink )
+	{
+		MirrorShrink( m, fullWidth, fullHeight, width, height );
+		glReadPixels( 0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0 );
+		m->fb.BindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+	}
+	else
+	{
+		glGetTexImage( GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_BYTE, 0 );
+	}
+	gl->EndQuery( GL_TIME_ELAPSED );
+	s->fence = gl->FenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	gl->BindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	compositor->UnlockGLSharedTextureForAccess( m->shared );
+
+	s->handle = handle;
+	s->width = width;
+	s->height = height;
+	s->scale = shrink ? scale : 1;
+	s->cpuSeconds = OGGetAbsoluteTime() - start;
+	s->gpuSeconds = 0;
+	atomic_store( &s->state, MirrorSlot_Reading );
+	return s;
+}
+
+// Returns a slot whose copy has finished, with its pixels taken out of the buffer, or NULL if
+// none are ready yet. The slot stays in MirrorSlot_Saving until whoever saves it sets it free.
+static inline struct MirrorSlot * MirrorPoll( struct Mirror * m )
+{
+	struct MirrorGL * gl = &m->gl;
+	for( int i = 0; i < MIRROR_SLOTS; i++ )
+	{
+		struct MirrorSlot * s = &m->slots[i];
+		if( atomic_load( &s->state ) != MirrorSlot_Reading )
+		{
+			continue;
+		}
+		GLenum status = gl->ClientWaitSync( s->fence, 0, 0 );
+		if( status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED )
+		{
+			continue;
+		}
+
+		double start = OGGetAbsoluteTime();
+		gl->DeleteSync( s->fence );
+		s->fence = NULL;
+		size_t size = (size_t)s->width * s->height * 4;
+		if( size > s->capacity )
+		{
+			free( s->pixels );
+			s->pixels = malloc( size );
+			s->capacity = s->pixels ? size : 0;
+		}
+		gl->BindBuffer( GL_PIXEL_PACK_BUFFER, s->buffer );
+		void * mapped = gl->MapBuffer( GL_PIXEL_PACK_BUFFER, GL_READ_ONLY );
+		if( mapped && s->pixels )
+		{
+			memcpy( s->pixels, mapped, size );
+		}
+		else
+		{
+			s->width = s->height = 0;
+		}
+		if( mapped )
+		{
+			gl->UnmapBuffer( GL_PIXEL_PACK_BUFFER );
+		}
+		gl->BindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+		uint64_t gpuNanoseconds = 0;
+		gl->GetQueryObjectui64v( s->query, GL_QUERY_RESULT, &gpuNanoseconds );
+		s->gpuSeconds = gpuNanoseconds / 1000000000.0;
+		s->cpuSeconds += OGGetAbsoluteTime() - start;
+		atomic_store( &s->state, MirrorSlot_Saving );
+		return s;
+	}
+	return NULL;
+}
+
+static inline void MirrorPut32( unsigned char * p, uint32_t v )
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+// Writes BGRA pixels, bottom row first (which is how both GL and BMP like them), as a 32 bit BMP.
+static inline bool MirrorWriteBMP( const char * path, const unsigned char * pixels, int width, int height )
+{
+	if( width <= 0 || height <= 0 )
+	{
+		return false;
+	}
+	uint32_t imageSize = (uint32_t)width * height * 4;
+	unsigned char header[54] = { 'B', 'M' };
+	MirrorPut32( header + 2, 54 + imageSize );
+	MirrorPut32( header + 10, 54 );
+	MirrorPut32( header + 14, 40 );
+	MirrorPut32( header + 18, width );
+	MirrorPut32( header + 22, height );
+	header[26] = 1;
+	header[28] = 32;
+	MirrorPut32( header + 34, imageSize );
+	FILE * f = fopen( path, "wb" );
+	if( !f )
+	{
+		return false;
+	}
+	bool ok = fwrite( header, 1, sizeof( header ), f ) == sizeof( header ) && fwrite( pixels, 1, imageSize, f ) == imageSize;
+	return fclose( f ) == 0 && ok;
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef _PISS_PATHS_H
+#define _PISS_PATHS_H
+
+// Every path PISS uses, worked out once. The folder the exe is in is looked up at startup and
+// every fixed path (config, stats, index...) is built from it then and kept in one fixed arena,
+// so nothing after that has to ask Windows where we are again.
+//
+// Screenshot names come from a template, by default
+//
+//	Screenshots\%Y-%m\%Y-%m-%d_%H-%M-%S
+//
+// which is compiled once into a list of literal runs and date fields. Making a name is then
+// just copying the runs and writing out the numbers, no strftime, no parsing, and nothing is
+// ever allocated. The template understands %Y %m %d %H %M %S and %%, and can use / or \,
+// which are both turned into whatever this OS uses.
+//
+// Needs piss_platform.h included first.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define PATHS_ARENA 4096
+#define PATHS_MAX_OPS 48
+#define DEFAULT_NAME_TEMPLATE "Screenshots\\%Y-%m\\%Y-%m-%d_%H-%M-%S"
+
+enum PathOpKind
+{
+	PathOp_Literal,
+	PathOp_Year,
+	PathOp_Month,
+	PathOp_Day,
+	PathOp_Hour,
+	PathOp_Minute,
+	PathOp_Second,
+};
+
+struct PathOp
+{
+	uint8_t kind;
+	uint16_t offset;				// literal text, in the arena
+	uint16_t length;
+};
+
+struct Paths
+{
+	char arena[PATHS_ARENA];
+	size_t used;
+	const char * root;				// the exe's folder, with the separator on the end
+	size_t rootLength;
+	size_t templateStart;			// the compiled template's text goes from here, the fixed paths are before it
+	struct PathOp ops[PATHS_MAX_OPS];
+	int opCount;
+};
+
+// Copies root and then rest into the arena and returns it, or NULL if the arena is full.
+static inline const char * PathsAdd( struct Paths * p, const char * root, const char * rest )
+{
+	size_t a = strlen( root ), b = strlen( rest );
+	if( p->used + a + b + 1 > PATHS_ARENA )
+	{
+		return NULL;
+	}
+	char * out = p->arena + p->used;
+	memcpy( out, root, a );
+	memcpy( out + a, rest, b + 1 );
+	p->used += a + b + 1;
+	return out;
+}
+
+static inline void PathsStart( struct Paths * p, const char * root )
+{
+	p->used = 0;
+	p->opCount = 0;
+	p->root = PathsAdd( p, root, "" );
+	p->rootLength = strlen( root );
+}
+
+// A path in the exe's folder. These all have to be added before the first PathsCompile().
+static inline const char * PathsAddFile( struct Paths * p, const char * name )
+{
+	return PathsAdd( p, p->root, name );
+}
+
+static inline bool PathsAddOp( struct Paths * p, int kind, const char * literal, size_t length )
+{
+	if( p->opCount && kind == PathOp_Literal && p->ops[p->opCount - 1].kind == PathOp_Literal &&
+		p->ops[p->opCount - 1].offset + p->ops[p->opCount - 1].length == p->used )
+	{
+		// Carry on the last run.
+		if( p->used + length > PATHS_ARENA )
+		{
+			return false;
+		}
+		memcpy( p->arena + p->used, literal, length );
+		p->used += length;
+		p->ops[p->opCount - 1].length += length;
+		return true;
+	}
+	if( p->opCount == PATHS_MAX_OPS || p->used + length > PATHS_ARENA )
+	{
+		return false;
+	}
+	struct PathOp * op = &p->ops[p->opCount++];
+	op->kind = kind;
+	op->offset = p->used;
+	op->length = length;
+	memcpy( p->arena + p->used, literal, length );
+	p->used += length;
+	return true;
+}
+
+// Compiles a name template. Returns false (and leaves the old one) if it's no good. The new one
+// is compiled after the old one in the arena and then moved down over it, so compiling again
+// (when the config is reloaded) doesn't use any more of the arena.
+static inline bool PathsCompile( struct Paths * p, const char * template )
+{
+	struct PathOp saved[PATHS_MAX_OPS];
+	int savedCount = p->opCount;
+	size_t savedUsed = p->used;
+	memcpy( saved, p->ops, sizeof( saved ) );
+	if( !p->opCount )
+	{
+		p->templateStart = p->used;
+	}
+	p->opCount = 0;
+
+	bool ok = *template != 0;
+	for( const char * c = template; *c && ok; c++ )
+	{
+		if( *c == '/' || *c == '\\' )
+		{
+			ok = PathsAddOp( p, PathOp_Literal, PLATFORM_SEPARATOR_STRING, 1 );
+			continue;
+		}
+		if( *c != '%' )
+		{
+			ok = PathsAddOp( p, PathOp_Literal, c, 1 );
+			continue;
+		}
+		if( !c[1] )
+		{
+			// A % on the end, which isn't anything.
+			ok = false;
+			break;
+		}
+		switch( *++c )
+		{
+		case 'Y': ok = PathsAddOp( p, PathOp_Year, "", 0 ); break;
+		case 'm': ok = PathsAddOp( p, PathOp_Month, "", 0 ); break;
+		case 'd': ok = PathsAddOp( p, PathOp_Day, "", 0 ); break;
+		case 'H': ok = PathsAddOp( p, PathOp_Hour, "", 0 ); break;
+		case 'M': ok = PathsAddOp( p, PathOp_Minute, "", 0 ); break;
+		case 'S': ok = PathsAddOp( p, PathOp_Second, "", 0 ); break;
+		case '%': ok = PathsAddOp( p, PathOp_Literal, "%", 1 ); break;
+		default: ok = false; break;
+		}
+	}
+	if( !ok )
+	{
+		memcpy( p->ops, saved, sizeof( saved ) );
+		p->opCount = savedCount;
+		p->used = savedUsed;
+		return false;
+	}
+
+	size_t shift = savedUsed - p->templateStart;
+	if( shift )
+	{
+		memmove( p->arena + p->templateStart, p->arena + savedUsed, p->used - savedUsed );
+		p->used -= shift;
+		for( int i = 0; i < p->opCount; i++ )
+		{
+			p->ops[i].offset -= shift;
+		}
+	}
+	return true;
+}
+
+static inline char * PathsPutNumber( char * out, int value, int digits )
+{
+	for( int i = digits - 1; i >= 0; i-- )
+	{
+		out[i] = '0' + value % 10;
+		value /= 10;
+	}
+	return out + digits;
+}
+
+// Writes the exe folder and then the template filled in for t. Returns the length, or 0 if it
+// wouldn't fit in size.
+static inline size_t PathsFormat( const struct Paths * p, const struct tm * t, char * out, size_t size )
+{
+	// Every field is at most 4 digits, which is cheaper to check up front than as we go.
+	size_t need = p->rootLength + 1;
+	for( int i = 0; i < p->opCount; i++ )
+	{
+		need += p->ops[i].kind == PathOp_Literal ? p->ops[i].length : 4;
+	}
+	if( need > size )
+	{
+		return 0;
+	}
+
+	char * o = out;
+	memcpy( o, p->root, p->rootLength );
+	o += p->rootLength;
+	for( int i = 0; i < p->opCount; i++ )
+	{
+		const struct PathOp * op = &p->ops[i];
+		switch( op->kind )
+		{
+		case PathOp_Literal:
+			memcpy( o, p->arena + op->offset, op->length );
+			o += op->length;
+			break;
+		case PathOp_Year: o = PathsPutNumber( o, t->tm_year + 1900, 4 ); break;
+		case PathOp_Month: o = PathsPutNumber( o, t->tm_mon + 1, 2 ); break;
+		case PathOp_Day: o = PathsPutNumber( o, t->tm_mday, 2 ); break;
+		case PathOp_Hour: o = PathsPutNumber( o, t->tm_hour, 2 ); break;
+		case PathOp_Minute: o = PathsPutNumber( o, t->tm_min, 2 ); break;
+		case PathOp_Second: o = PathsPutNumber( o, t->tm_sec, 2 ); break;
+		}
+	}
+	*o = 0;
+	return o - out;
+}
+
+#endif
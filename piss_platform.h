@@ -0,0 +1,513 @@
+#ifndef _PISS_PLATFORM_H
+#define _PISS_PLATFORM_H
+
+// The few things PISS needs from the OS: where the exe is, making folders, the wall clock, a
+// timer to wait for the next capture on, hearing about folders going away, the key that asks
+// for stats, how much CPU and memory we've used, and mapping a file to read it in place.
+//
+// PISS ships on Windows. The POSIX side is there so the scheduler, paths and the capture
+// pipeline can be built and benchmarked on a Linux box with no headset.
+//
+// On Windows this needs windows.h included first (rawdraw_sf.h brings it in).
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined( _WIN32 )
+
+#include <psapi.h>
+
+#define PLATFORM_SEPARATOR '\\'
+#define PLATFORM_SEPARATOR_STRING "\\"
+
+// Unix time is seconds since 1970, FILETIME is 100ns ticks since 1601.
+#define FILETIME_UNIX_EPOCH 11644473600LL
+#define FILETIME_TICKS_PER_SECOND 10000000LL
+
+// Fills path with the folder the exe is in, including the trailing slash.
+static inline void PlatformExeDirectory( char * path )
+{
+	char drive[_MAX_DRIVE];
+	char dir[_MAX_DIR];
+	char fname[_MAX_FNAME];
+	char ext[_MAX_EXT];
+
+	// Gets the path of the exe file
+	GetModuleFileName( NULL, path, _MAX_PATH );
+	_splitpath( path, drive, dir, fname, ext );
+	_makepath( path, drive, dir, NULL, NULL ); // removes the file name and extension from the buffer
+}
+
+// Returns true if the folder is there afterwards, including if it already was.
+static inline bool PlatformMakeFolder( const char * path )
+{
+	return CreateDirectory( path, NULL ) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+static inline bool PlatformFolderExists( const char * path )
+{
+	DWORD attributes = GetFileAttributes( path );
+	return attributes != INVALID_FILE_ATTRIBUTES && ( attributes & FILE_ATTRIBUTE_DIRECTORY );
+}
+
+// The wall clock as seconds since 1970, but with sub-millisecond precision unlike time().
+// GetSystemTimePreciseAsFileTime is only there from Windows 8 on, and older mingw headers don't
+// declare it at all, so it's looked up when first needed. Without it the time is only as good as
+// the system tick, which is still better than a second.
+typedef VOID ( WINAPI * PlatformGetTimeFn )( LPFILETIME );
+static inline double PlatformWallClock()
+{
+	static PlatformGetTimeFn getTime;
+	if( !getTime )
+	{
+		getTime = (PlatformGetTimeFn)GetProcAddress( GetModuleHandle( "kernel32.dll" ), "GetSystemTimePreciseAsFileTime" );
+		if( !getTime )
+		{
+			getTime = GetSystemTimeAsFileTime;
+		}
+	}
+	FILETIME ft;
+	getTime( &ft );
+	LONGLONG ticks = ( (LONGLONG)ft.dwHighDateTime << 32 ) | ft.dwLowDateTime;
+	return (double)( ticks - FILETIME_UNIX_EPOCH * FILETIME_TICKS_PER_SECOND ) / FILETIME_TICKS_PER_SECOND;
+}
+
+static inline void PlatformSleepMs( int ms )
+{
+	Sleep( ms );
+}
+
+// A timer that goes off at a wall clock time. It's given an absolute UTC due time, so it also
+// follows changes to the system clock.
+struct PlatformTimer
+{
+	HANDLE handle;
+};
+
+static inline bool PlatformTimerStart( struct PlatformTimer * t )
+{
+	t->handle = CreateWaitableTimer( NULL, TRUE, NULL );
+	return t->handle != NULL;
+}
+
+static inline bool PlatformTimerSet( struct PlatformTimer * t, time_t deadline )
+{
+	LARGE_INTEGER due;
+	due.QuadPart = ( (LONGLONG)deadline + FILETIME_UNIX_EPOCH ) * FILETIME_TICKS_PER_SECOND;
+	return SetWaitableTimer( t->handle, &due, 0, NULL, NULL, FALSE );
+}
+
+// Waits for the timer or timeoutMs, whichever comes first. Returns true if it was the timer.
+// It's a manual reset timer, so it has to be set again before it's waited on next time.
+static inline bool PlatformTimerWait( struct PlatformTimer * t, int timeoutMs )
+{
+	return WaitForSingleObject( t->handle, timeoutMs ) == WAIT_OBJECT_0;
+}
+
+// Tells us when a folder anywhere under the one being watched is deleted or renamed. Folders
+// being made don't count, they're nearly always ours, and it's only ones going away that
+// matter to anything remembering which folders are there.
+struct PlatformWatch
+{
+	HANDLE folder;
+	HANDLE event;
+	OVERLAPPED overlapped;
+	DWORD changes[1024];		// FILE_NOTIFY_INFORMATIONs, which have to be DWORD aligned
+	bool listening;
+};
+
+static inline bool PlatformWatchListen( struct PlatformWatch * w )
+{
+	memset( &w->overlapped, 0, sizeof( w->overlapped ) );
+	w->overlapped.hEvent = w->event;
+	w->listening = ReadDirectoryChangesW( w->folder, w->changes, sizeof( w->changes ), TRUE, FILE_NOTIFY_CHANGE_DIR_NAME,
+		NULL, &w->overlapped, NULL );
+	return w->listening;
+}
+
+static inline bool PlatformWatchStart( struct PlatformWatch * w, const char * folder )
+{
+	w->listening = false;
+	w->event = CreateEvent( NULL, TRUE, FALSE, NULL );
+	w->folder = CreateFile( folder, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL );
+	return w->event && w->folder != INVALID_HANDLE_VALUE && PlatformWatchListen( w );
+}
+
+// Windows watches the whole tree, so there's nothing more to add.
+static inline bool PlatformWatchAdd( struct PlatformWatch * w, const char * folder )
+{
+	return w->listening;
+}
+
+// Returns true if a folder went away since last time, or if we can't tell.
+static inline bool PlatformWatchChanged( struct PlatformWatch * w )
+{
+	if( !w->listening )
+	{
+		return true;
+	}
+	DWORD bytes;
+	if( !GetOverlappedResult( w->folder, &w->overlapped, &bytes, FALSE ) )
+	{
+		if( GetLastError() == ERROR_IO_INCOMPLETE )
+		{
+			return false;
+		}
+		PlatformWatchListen( w );
+		return true;
+	}
+	// Nothing at all means there were too many to fit, so anything could have happened.
+	bool gone = bytes == 0;
+	const char * at = (const char *)w->changes;
+	while( bytes )
+	{
+		const FILE_NOTIFY_INFORMATION * change = (const FILE_NOTIFY_INFORMATION *)at;
+		if( change->Action == FILE_ACTION_REMOVED || change->Action == FILE_ACTION_RENAMED_OLD_NAME )
+		{
+			gone = true;
+		}
+		if( !change->NextEntryOffset )
+		{
+			break;
+		}
+		at += change->NextEntryOffset;
+	}
+	PlatformWatchListen( w );
+	return gone;
+}
+
+static volatile int * platformStatsFlag;
+
+static BOOL WINAPI PlatformConsoleHandler( DWORD ctrlType )
+{
+	if( ctrlType == CTRL_BREAK_EVENT )
+	{
+		*platformStatsFlag = 1;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// Sets flag whenever someone presses Ctrl+Break in the console.
+static inline void PlatformCatchStatsKey( volatile int * flag )
+{
+	platformStatsFlag = flag;
+	SetConsoleCtrlHandler( PlatformConsoleHandler, TRUE );
+}
+
+// CPU time used by the whole process (every thread, user and kernel) in seconds.
+static inline double PlatformCpuSeconds()
+{
+	FILETIME created, exited, kernel, user;
+	if( !GetProcessTimes( GetCurrentProcess(), &created, &exited, &kernel, &user ) )
+	{
+		return 0;
+	}
+	ULONGLONG k = ( (ULONGLONG)kernel.dwHighDateTime << 32 ) | kernel.dwLowDateTime;
+	ULONGLONG u = ( (ULONGLONG)user.dwHighDateTime << 32 ) | user.dwLowDateTime;
+	return (double)( k + u ) / FILETIME_TICKS_PER_SECOND;
+}
+
+// The most memory the process has had resident at once, in bytes. Needs psapi.
+static inline long long PlatformPeakMemory()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	if( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+	{
+		return 0;
+	}
+	return (long long)counters.PeakWorkingSetSize;
+}
+
+// A read-only view of a whole file as it was when it was mapped. Other processes can carry on
+// writing to the end of it, which is fine, that just isn't in the view until it's mapped again.
+struct PlatformMap
+{
+	const void * data;			// NULL for an empty file
+	size_t size;
+	HANDLE mapping;
+};
+
+static inline bool PlatformMapFile( struct PlatformMap * m, const char * path )
+{
+	memset( m, 0, sizeof( *m ) );
+	HANDLE file = CreateFile( path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	bool ok = GetFileSizeEx( file, &size );
+	if( ok && size.QuadPart > 0 )
+	{
+		m->mapping = CreateFileMapping( file, NULL, PAGE_READONLY, size.HighPart, size.LowPart, NULL );
+		m->data = m->mapping ? MapViewOfFile( m->mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size.QuadPart ) : NULL;
+		m->size = m->data ? (size_t)size.QuadPart : 0;
+		ok = m->data != NULL;
+	}
+	CloseHandle( file );
+	return ok;
+}
+
+static inline void PlatformUnmapFile( struct PlatformMap * m )
+{
+	if( m->data )
+	{
+		UnmapViewOfFile( m->data );
+	}
+	if( m->mapping )
+	{
+		CloseHandle( m->mapping );
+	}
+	memset( m, 0, sizeof( *m ) );
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined( __linux__ )
+#include <sys/inotify.h>
+#endif
+
+#ifndef _MAX_PATH
+#define _MAX_PATH 1024
+#endif
+
+#define PLATFORM_SEPARATOR '/'
+#define PLATFORM_SEPARATOR_STRING "/"
+
+static inline void PlatformExeDirectory( char * path )
+{
+	ssize_t length = readlink( "/proc/self/exe", path, _MAX_PATH - 1 );
+	if( length <= 0 )
+	{
+		// No /proc, so the current folder will have to do.
+		strcpy( path, "./" );
+		return;
+	}
+	path[length] = 0;
+	char * slash = strrchr( path, '/' );
+	slash[1] = 0;
+}
+
+static inline bool PlatformMakeFolder( const char * path )
+{
+	return mkdir( path, 0777 ) == 0 || errno == EEXIST;
+}
+
+static inline bool PlatformFolderExists( const char * path )
+{
+	struct stat st;
+	return stat( path, &st ) == 0 && S_ISDIR( st.st_mode );
+}
+
+static inline double PlatformWallClock()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_REALTIME, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static inline void PlatformSleepMs( int ms )
+{
+	struct timespec ts = { ms / 1000, ( ms % 1000 ) * 1000000L };
+	while( nanosleep( &ts, &ts ) && errno == EINTR );
+}
+
+// There's no timer object to wait on, but sleeping until an absolute CLOCK_REALTIME time
+// follows changes to the clock the same way. time() runs off a coarser clock that can be a tick
+// behind, so we wake a little after the second starts and check with time() like the caller
+// will, or the caller would see it as early and wait again straight away.
+#define PLATFORM_TIMER_SLACK_NS 10000000L
+struct PlatformTimer
+{
+	time_t deadline;
+};
+
+static inline bool PlatformTimerStart( struct PlatformTimer * t )
+{
+	t->deadline = 0;
+	return true;
+}
+
+static inline bool PlatformTimerSet( struct PlatformTimer * t, time_t deadline )
+{
+	t->deadline = deadline;
+	return true;
+}
+
+static inline bool PlatformTimerWait( struct PlatformTimer * t, int timeoutMs )
+{
+	struct timespec now, wake;
+	clock_gettime( CLOCK_REALTIME, &now );
+	if( !t->deadline || time( NULL ) < t->deadline )
+	{
+		wake.tv_sec = now.tv_sec + timeoutMs / 1000;
+		wake.tv_nsec = now.tv_nsec + ( timeoutMs % 1000 ) * 1000000L;
+		if( wake.tv_nsec >= 1000000000L )
+		{
+			wake.tv_sec++;
+			wake.tv_nsec -= 1000000000L;
+		}
+		if( t->deadline && ( wake.tv_sec > t->deadline || ( wake.tv_sec == t->deadline && wake.tv_nsec > PLATFORM_TIMER_SLACK_NS ) ) )
+		{
+			wake.tv_sec = t->deadline;
+			wake.tv_nsec = PLATFORM_TIMER_SLACK_NS;
+		}
+		while( clock_nanosleep( CLOCK_REALTIME, TIMER_ABSTIME, &wake, NULL ) == EINTR );
+	}
+	if( t->deadline && time( NULL ) >= t->deadline )
+	{
+		t->deadline = 0;
+		return true;
+	}
+	return false;
+}
+
+// inotify only watches the folders it's given, not everything under them, so whoever starts
+// the watch adds the folders inside it they care about. Elsewhere we can never tell. As on
+// Windows, only folders going away count.
+struct PlatformWatch
+{
+	int fd;
+};
+
+static inline bool PlatformWatchAdd( struct PlatformWatch * w, const char * folder )
+{
+#if defined( __linux__ )
+	return w->fd >= 0 && inotify_add_watch( w->fd, folder, IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF | IN_ONLYDIR ) >= 0;
+#else
+	return false;
+#endif
+}
+
+static inline bool PlatformWatchStart( struct PlatformWatch * w, const char * folder )
+{
+#if defined( __linux__ )
+	w->fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+#else
+	w->fd = -1;
+#endif
+	return PlatformWatchAdd( w, folder );
+}
+
+static inline bool PlatformWatchChanged( struct PlatformWatch * w )
+{
+	if( w->fd < 0 )
+	{
+		return true;
+	}
+	bool changed = false;
+#if defined( __linux__ )
+	// Files being deleted or renamed in a watched folder come through as well, only folders count.
+	char events[4096] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+	ssize_t length;
+	while( ( length = read( w->fd, events, sizeof( events ) ) ) > 0 )
+	{
+		for( char * at = events; at < events + length; at += sizeof( struct inotify_event ) + ( (struct inotify_event *)at )->len )
+		{
+			uint32_t mask = ( (struct inotify_event *)at )->mask;
+			if( ( mask & IN_ISDIR ) || ( mask & ( IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_Q_OVERFLOW ) ) )
+			{
+				changed = true;
+			}
+		}
+	}
+#endif
+	return changed;
+}
+
+// Ctrl+\ is the closest thing a terminal has to Ctrl+Break, and it's a signal we can catch.
+static volatile int * platformStatsFlag;
+
+static void PlatformSignalHandler( int signal )
+{
+	*platformStatsFlag = 1;
+}
+
+static inline void PlatformCatchStatsKey( volatile int * flag )
+{
+	platformStatsFlag = flag;
+	struct sigaction action;
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = PlatformSignalHandler;
+	action.sa_flags = SA_RESTART;
+	sigaction( SIGQUIT, &action, NULL );
+}
+
+static inline double PlatformCpuSeconds()
+{
+	struct rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) )
+	{
+		return 0;
+	}
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1000000.0;
+}
+
+static inline long long PlatformPeakMemory()
+{
+	struct rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) )
+	{
+		return 0;
+	}
+#if defined( __APPLE__ )
+	return usage.ru_maxrss;
+#else
+	return usage.ru_maxrss * 1024LL;	// Linux counts it in kilobytes
+#endif
+}
+
+struct PlatformMap
+{
+	const void * data;
+	size_t size;
+};
+
+static inline bool PlatformMapFile( struct PlatformMap * m, const char * path )
+{
+	memset( m, 0, sizeof( *m ) );
+	int fd = open( path, O_RDONLY | O_CLOEXEC );
+	if( fd < 0 )
+	{
+		return false;
+	}
+	struct stat st;
+	bool ok = fstat( fd, &st ) == 0;
+	if( ok && st.st_size > 0 )
+	{
+		void * data = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+		ok = data != MAP_FAILED;
+		if( ok )
+		{
+			m->data = data;
+			m->size = (size_t)st.st_size;
+		}
+	}
+	close( fd );
+	return ok;
+}
+
+static inline void PlatformUnmapFile( struct PlatformMap * m )
+{
+	if( m->data )
+	{
+		munmap( (void *)m->data, m->size );
+	}
+	memset( m, 0, sizeof( *m ) );
+}
+
+#endif
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef _PISS_REPLAY_H
+#define _PISS_REPLAY_H
+
+// Instant replay: the last few seconds of small mirror frames, kept compressed in memory so
+// that when something worth keeping happens we can save what led up to it, not just what
+// comes after.
+//
+// Everything lives in one block allocated up front, the size of the cap. A quarter of it at most
+// goes on the buffers a frame is worked on in (so a small cap means a smaller largest frame), and
+// the rest is the ring: frames are compressed and packed into it end to end, and when a new frame
+// doesn't fit, the oldest ones are dropped until it does. Frames older than the replay length are
+// dropped as well. Nothing is allocated per frame, so the replay can never go over the cap.
+//
+// Frames are normally shrunk on the GPU before they're read back (see MirrorRead), and only
+// shrunk here if the GPU couldn't.
+//
+// Frames are compressed with a QOI style encoder (runs, a 64 entry table of recent colours,
+// and small differences from the last pixel), which is about as fast as memcpy-ing the frame
+// and does well on the flat areas games are full of. Alpha is dropped.
+//
+// While a replay is being saved the ring is left alone (see saving), and frames that come in
+// meanwhile are dropped. Needs piss_mirror.h included first.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_MAX_FRAMES 4096
+#define REPLAY_MAX_PIXELS ( 1024 * 1024 )	// the largest frame we'll keep, after shrinking
+
+struct ReplayFrame
+{
+	size_t offset;
+	size_t size;
+	int width;
+	int height;
+	double time;
+};
+
+struct Replay
+{
+	bool enabled;
+	double seconds;					// how far back to keep
+	int scale;						// frames are shrunk by this much each way
+	unsigned char * block;			// everything, allocated once
+	size_t maxPixels;				// the largest frame we'll keep, after shrinking
+	unsigned char * arena;
+	size_t arenaSize;
+	size_t head;					// where the newest frame ends
+	size_t used;
+	struct ReplayFrame frames[REPLAY_MAX_FRAMES];
+	int first;						// oldest frame
+	int count;
+	unsigned char * small;			// the frame being added, shrunk
+	unsigned char * packed;			// the frame being added, compressed
+	unsigned char * unpacked;		// the frame being saved
+	atomic_int saving;
+	long long framesAdded;
+	long long framesDropped;		// came in while saving, or didn't fit at all
+	double rawBytes;
+	double packedBytes;
+	double packSeconds;
+};
+
+static inline bool ReplayStart( struct Replay * r, double seconds, size_t memory, int scale )
+{
+	r->seconds = seconds;
+	r->scale = scale < 1 ? 1 : scale;
+	// Three frame buffers of 4 bytes a pixel, in no more than a quarter of it.
+	r->maxPixels = memory / 48 < REPLAY_MAX_PIXELS ? memory / 48 : REPLAY_MAX_PIXELS;
+	size_t frame = r->maxPixels * 4;
+	r->block = malloc( memory );
+	r->small = r->block;
+	r->packed = r->small + frame;
+	r->unpacked = r->packed + frame;
+	r->arena = r->unpacked + frame;
+	r->arenaSize = memory - frame * 3;
+	r->head = r->used = 0;
+	r->first = r->count = 0;
+	atomic_store( &r->saving, 0 );
+	r->enabled = r->block && r->maxPixels;
+	return r->enabled;
+}
+
+static inline void ReplayDropOldest( struct Replay * r )
+{
+	r->used -= r->frames[r->first].size;
+	r->first = ( r->first + 1 ) % REPLAY_MAX_FRAMES;
+	if( !--r->count )
+	{
+		r->head = 0;
+	}
+}
+
+static inline int ReplayColorHash( unsigned char r, unsigned char g, unsigned char b )
+{
+	return ( r * 3 + g * 5 + b * 7 + 255 * 11 ) % 64;
+}
+
+// Compresses count BGRA pixels. Needs up to 4 bytes a pixel of room. Returns the size.
+static inline size_t ReplayPack( const unsigned char * px, int count, unsigned char * out )
+{
+	unsigned char seen[64][3] = { { 0 } };
+	unsigned char pr = 0, pg = 0, pb = 0;
+	int run = 0;
+	size_t o = 0;
+	for( int i = 0; i < count; i++, px += 4 )
+	{
+		unsigned char b = px[0], g = px[1], r = px[2];
+		if( r == pr && g == pg && b == pb )
+		{
+			if( ++run == 62 )
+			{
+				out[o++] = 0xc0 | ( run - 1 );
+				run = 0;
+			}
+			continue;
+		}
+		if( run )
+		{
+			out[o++] = 0xc0 | ( run - 1 );
+			run = 0;
+		}
+
+		int h = ReplayColorHash( r, g, b );
+		if( seen[h][0] == r && seen[h][1] == g && seen[h][2] == b )
+		{
+			out[o++] = h;
+		}
+		else
+		{
+			seen[h][0] = r; seen[h][1] = g; seen[h][2] = b;
+			signed char dr = (signed char)( r - pr ), dg = (signed char)( g - pg ), db = (signed char)( b - pb );
+			int drg = dr - dg, dbg = db - dg;
+			if( dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1 )
+			{
+				out[o++] = 0x40 | ( dr + 2 ) << 4 | ( dg + 2 ) << 2 | ( db + 2 );
+			}
+			else if( dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7 )
+			{
+				out[o++] = 0x80 | ( dg + 32 );
+				out[o++] = ( drg + 8 ) << 4 | ( dbg + 8 );
+			}
+			else
+			{
+				out[o++] = 0xfe;
+				out[o++] = r;
+				out[o++] = g;
+				out[o++] = b;
+			}
+		}
+		pr = r; pg = g; pb = b;
+	}
+	if( run )
+	{
+		out[o++] = 0xc0 | ( run - 1 );
+	}
+	return o;
+}
+
+// Undoes ReplayPack into count BGRA pixels.
+static inline void ReplayUnpack( const unsigned char * in, size_t size, unsigned char * px, int count )
+{
+	unsigned char seen[64][3] = { { 0 } };
+	unsigned char r = 0, g = 0, b = 0;
+	int run = 0;
+	size_t p = 0;
+	for( int i = 0; i < count; i++, px += 4 )
+	{
+		if( run )
+		{
+			run--;
+		}
+		else if( p < size )
+		{
+			unsigned char op = in[p++];
+			if( op == 0xfe )
+			{
+				r = in[p]; g = in[p + 1]; b = in[p + 2];
+				p += 3;
+			}
+			else
+			{
+				switch( op & 0xc0 )
+				{
+				case 0x00:
+					r = seen[op][0]; g = seen[op][1]; b = seen[op][2];
+					break;
+				case 0x40:
+					r += ( ( op >> 4 ) & 3 ) - 2;
+					g += ( ( op >> 2 ) & 3 ) - 2;
+					b += ( op & 3 ) - 2;
+					break;
+				case 0x80:
+				{
+					int dg = ( op & 0x3f ) - 32;
+					unsigned char next = in[p++];
+					r += dg - 8 + ( next >> 4 );
+					g += dg;
+					b += dg - 8 + ( next & 0x0f );
+					break;
+				}
+				case 0xc0:
+					run = op & 0x3f;
+					break;
+				}
+			}
+			int h = ReplayColorHash( r, g, b );
+			seen[h][0] = r; seen[h][1] = g; seen[h][2] = b;
+		}
+		px[0] = b; px[1] = g; px[2] = r; px[3] = 255;
+	}
+}
+
+// Box filters BGRA pixels down by scale each way. Returns false if the result is too big to keep.
+static inline bool ReplayShrink( const unsigned char * px, int width, int height, int scale, size_t maxPixels, unsigned char * out, int * outWidth, int * outHeight )
+{
+	int w = width / scale, h = height / scale;
+	if( w <= 0 || h <= 0 || (size_t)w * h > maxPixels )
+	{
+		return false;
+	}
+	int area = scale * scale;
+	for( int y = 0; y < h; y++ )
+	{
+		for( int x = 0; x < w; x++ )
+		{
+			unsigned int sum[3] = { 0, 0, 0 };
+			for( int sy = 0; sy < scale; sy++ )
+			{
+				const unsigned char * row = px + ( (size_t)( y * scale + sy ) * width + x * scale ) * 4;
+				for( int sx = 0; sx < scale; sx++, row += 4 )
+				{
+					sum[0] += row[0]; sum[1] += row[1]; sum[2] += row[2];
+				}
+			}
+			unsigned char * o = out + ( (size_t)y * w + x ) * 4;
+			o[0] = sum[0] / area; o[1] = sum[1] / area; o[2] = sum[2] / area; o[3] = 255;
+		}
+	}
+	*outWidth = w;
+	*outHeight = h;
+	return true;
+}
+
+// Adds a BGRA frame taken at time now, which still needs shrinking by scale each way (1 if the GPU
+// already did it).
+static inline void ReplayAdd( struct Replay * r, const unsigned char * px, int width, int height, int scale, double now )
+{
+	if( !r->enabled || atomic_load( &r->saving ) || width <= 0 || height <= 0 )
+	{
+		r->framesDropped++;
+		return;
+	}
+	int w = width, h = height;
+	if( scale > 1 )
+	{
+		if( !ReplayShrink( px, width, height, scale, r->maxPixels, r->small, &w, &h ) )
+		{
+			r->framesDropped++;
+			return;
+		}
+		px = r->small;
+	}
+	else if( (size_t)w * h > r->maxPixels )
+	{
+		r->framesDropped++;
+		return;
+	}
+	double start = OGGetAbsoluteTime();
+	size_t size = ReplayPack( px, w * h, r->packed );
+	r->packSeconds += OGGetAbsoluteTime() - start;
+	r->rawBytes += (double)w * h * 3;
+	r->packedBytes += size;
+	if( size > r->arenaSize )
+	{
+		r->framesDropped++;
+		return;
+	}
+
+	while( r->count && now - r->frames[r->first].time > r->seconds )
+	{
+		ReplayDropOldest( r );
+	}
+
+	// Find room after the newest frame, dropping the oldest ones until there is some.
+	size_t offset;
+	for( ;; )
+	{
+		if( !r->count )
+		{
+			offset = 0;
+			break;
+		}
+		size_t tail = r->frames[r->first].offset;
+		if( r->count < REPLAY_MAX_FRAMES )
+		{
+			if( r->head > tail )
+			{
+				if( r->head + size <= r->arenaSize )
+				{
+					offset = r->head;
+					break;
+				}
+				if( size <= tail )
+				{
+					offset = 0;
+					break;
+				}
+			}
+			else if( r->head + size <= tail )
+			{
+				offset = r->head;
+				break;
+			}
+		}
+		ReplayDropOldest( r );
+	}
+
+	memcpy( r->arena + offset, r->packed, size );
+	struct ReplayFrame * f = &r->frames[( r->first + r->count ) % REPLAY_MAX_FRAMES];
+	f->offset = offset;
+	f->size = size;
+	f->width = w;
+	f->height = h;
+	f->time = now;
+	r->count++;
+	r->head = offset + size;
+	r->used += size;
+	r->framesAdded++;
+}
+
+// Writes every frame in the ring to folder as numbered BMPs, oldest first, and lets the ring
+// carry on. Run this with saving set so nothing else touches the ring. Returns how many were written.
+static inline int ReplaySave( struct Replay * r, const char * folder, char separator )
+{
+	int written = 0;
+	for( int i = 0; i < r->count; i++ )
+	{
+		struct ReplayFrame * f = &r->frames[( r->first + i ) % REPLAY_MAX_FRAMES];
+		ReplayUnpack( r->arena + f->offset, f->size, r->unpacked, f->width * f->height );
+		char path[1024];
+		snprintf( path, sizeof( path ), "%s%cframe_%04d.bmp", folder, separator, i );
+		written += MirrorWriteBMP( path, r->unpacked, f->width, f->height );
+	}
+	atomic_store( &r->saving, 0 );
+	return written;
+}
+
+#endif
@@ -0,0 +1,448 @@
+#ifndef _PISS_SCHEDULE_H
+#define _PISS_SCHEDULE_H
+
+// The capture schedule. A schedule is a list of rules, each of which can say when it next wants
+// a screenshot. We keep a min-heap with one entry per rule holding that rule's next fire time,
+// so the main loop only ever has to look at the top of the heap to know when to wake up, and
+// firing a rule is just a pop and a push (O(log n) even with hundreds of rules).
+//
+// Nothing in here reads the clock, every function is given the time it should work from. That
+// way the same code can be run against a fake clock to check what it would do over days or years.
+//
+// Rules are written as text, one per line in the config file:
+//
+//	every 60m                            top of every hour (the default)
+//	every 15m offset 5m                  :05, :20, :35 and :50 past every hour
+//	every 10m on mon-fri from 09:00 to 17:00
+//	at 12:30                             every day at half past twelve
+//	at 20:00:00 on sat,sun
+//	every 6h type cubemap                any rule can say what kind of screenshot it wants
+//
+// Intervals are counted from the unix epoch, so "every 60m" lines up with the top of the hour
+// in UTC just like PISS always has. Times of day, days of the week and windows are local time.
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SCHEDULE_MAX_RULES 1024
+#define SCHEDULE_ALL_DAYS 0x7f
+
+enum ScheduleRuleKind
+{
+	ScheduleRule_Every,		// every periodSeconds, shifted by offsetSeconds
+	ScheduleRule_At,		// once a day at atSeconds after local midnight
+};
+
+struct ScheduleRule
+{
+	int kind;
+	int periodSeconds;
+	int offsetSeconds;
+	int atSeconds;
+	uint8_t dayMask;		// bit 0 is Sunday, same as tm_wday
+	int windowStart;		// seconds after local midnight, only fire in [windowStart, windowEnd)
+	int windowEnd;			// if windowStart == windowEnd there is no window, if start > end it wraps past midnight
+	char typeName[16];		// the kind of screenshot, from "type <name>", or empty for the default
+	int type;				// not touched in here, for the caller to fill in from typeName
+};
+
+struct ScheduleEntry
+{
+	time_t next;
+	int rule;
+};
+
+struct Schedule
+{
+	struct ScheduleRule rules[SCHEDULE_MAX_RULES];
+	int ruleCount;
+	struct ScheduleEntry heap[SCHEDULE_MAX_RULES];
+	int heapCount;
+};
+
+static inline void ScheduleLocalTime( time_t t, struct tm * out )
+{
+#if defined( WIN32 ) || defined( WINDOWS ) || defined( _WIN32 )
+	localtime_s( out, &t );
+#else
+	localtime_r( &t, out );
+#endif
+}
+
+// Local time at secondOfDay on the day `days` after the one in tm. mktime sorts out month and
+// year rollover, and DST (a time that doesn't exist that day gets pushed forward).
+static inline time_t ScheduleLocalDayTime( const struct tm * day, int days, int secondOfDay )
+{
+	struct tm t = *day;
+	t.tm_mday += days;
+	t.tm_hour = secondOfDay / 3600;
+	t.tm_min = ( secondOfDay / 60 ) % 60;
+	t.tm_sec = secondOfDay % 60;
+	t.tm_isdst = -1;
+	return mktime( &t );
+}
+
+static inline int ScheduleRuleAllows( const struct ScheduleRule * r, time_t t )
+{
+	struct tm lt;
+	ScheduleLocalTime( t, &lt );
+	if( !( r->dayMask & ( 1 << lt.tm_wday ) ) )
+	{
+		return 0;
+	}
+	if( r->windowStart == r->windowEnd )
+	{
+		return 1;
+	}
+	int sod = lt.tm_hour * 3600 + lt.tm_min * 60 + lt.tm_sec;
+	if( r->windowStart < r->windowEnd )
+	{
+		return sod >= r->windowStart && sod < r->windowEnd;
+	}
+	return sod >= r->windowStart || sod < r->windowEnd;
+}
+
+// First time strictly after `after` that lines up with an Every rule's period and offset.
+static inline time_t ScheduleAlignAfter( const struct ScheduleRule * r, time_t after )
+{
+	long long p = r->periodSeconds;
+	long long base = (long long)after - r->offsetSeconds;
+	long long k = base >= 0 ? base / p : -( ( -base + p - 1 ) / p );	// floor( base / p )
+	k++;
+	return (time_t)( k * p + r->offsetSeconds );
+}
+
+// When a rule next wants to fire strictly after `after`, or 0 if it never will.
+static inline time_t ScheduleRuleNext( const struct ScheduleRule * r, time_t after )
+{
+	struct tm lt;
+	if( r->kind == ScheduleRule_At )
+	{
+		ScheduleLocalTime( after, &lt );
+		// Eight days covers every day of the week, plus today if the time has already passed.
+		for( int d = 0; d <= 8; d++ )
+		{
+			time_t t = ScheduleLocalDayTime( &lt, d, r->atSeconds );
+			if( t > after && ScheduleRuleAllows( r, t ) )
+			{
+				return t;
+			}
+		}
+		return 0;
+	}
+
+	time_t t = ScheduleAlignAfter( r, after );
+	for( int tries = 0; tries < 64; tries++ )
+	{
+		if( ScheduleRuleAllows( r, t ) )
+		{
+			return t;
+		}
+
+		// Outside of the allowed days or window, so skip forward to the next time it opens
+		// rather than stepping through every period in between.
+		ScheduleLocalTime( t, &lt );
+		time_t open = 0;
+		for( int d = 0; d <= 8 && !open; d++ )
+		{
+			time_t s = ScheduleLocalDayTime( &lt, d, r->windowStart );
+			if( s >= t && ScheduleRuleAllows( r, s ) )
+			{
+				open = s;
+			}
+		}
+		if( !open )
+		{
+			return 0;
+		}
+		t = ScheduleAlignAfter( r, open - 1 );
+	}
+	return 0;
+}
+
+static inline int ScheduleEntryLess( const struct ScheduleEntry * a, const struct ScheduleEntry * b )
+{
+	return a->next < b->next || ( a->next == b->next && a->rule < b->rule );
+}
+
+static inline void ScheduleHeapSwap( struct Schedule * s, int a, int b )
+{
+	struct ScheduleEntry tmp = s->heap[a];
+	s->heap[a] = s->heap[b];
+	s->heap[b] = tmp;
+}
+
+static inline void ScheduleHeapPush( struct Schedule * s, time_t next, int rule )
+{
+	int i = s->heapCount++;
+	s->heap[i].next = next;
+	s->heap[i].rule = rule;
+	while( i > 0 )
+	{
+		int parent = ( i - 1 ) / 2;
+		if( !ScheduleEntryLess( &s->heap[i], &s->heap[parent] ) )
+		{
+			break;
+		}
+		ScheduleHeapSwap( s, i, parent );
+		i = parent;
+	}
+}
+
+static inline void ScheduleHeapRemoveTop( struct Schedule * s )
+{
+	s->heap[0] = s->heap[--s->heapCount];
+	int i = 0;
+	while( true )
+	{
+		int l = i * 2 + 1;
+		int r = l + 1;
+		int smallest = i;
+		if( l < s->heapCount && ScheduleEntryLess( &s->heap[l], &s->heap[smallest] ) ) smallest = l;
+		if( r < s->heapCount && ScheduleEntryLess( &s->heap[r], &s->heap[smallest] ) ) smallest = r;
+		if( smallest == i )
+		{
+			break;
+		}
+		ScheduleHeapSwap( s, i, smallest );
+		i = smallest;
+	}
+}
+
+// Parses "30s", "90m", "1h" or "2d". Returns seconds, or -1 if it isn't one of those exactly
+// (there has to be a unit, and nothing after it), or it's more than an int holds.
+static inline int ScheduleParseDuration( const char * text )
+{
+	int n, used = 0;
+	char unit;
+	if( sscanf( text, "%d%c%n", &n, &unit, &used ) != 2 || text[used] || n < 0 )
+	{
+		return -1;
+	}
+	int scale;
+	switch( unit )
+	{
+	case 's': scale = 1; break;
+	case 'm': scale = 60; break;
+	case 'h': scale = 3600; break;
+	case 'd': scale = 86400; break;
+	default: return -1;
+	}
+	if( n > INT_MAX / scale )
+	{
+		return -1;
+	}
+	return n * scale;
+}
+
+// Parses "HH:MM" or "HH:MM:SS". Returns seconds after midnight, or -1. 24:00 is allowed, as the
+// end of the day, but nothing past it.
+static inline int ScheduleParseTimeOfDay( const char * text )
+{
+	int h, m, sec = 0;
+	if( sscanf( text, "%d:%d:%d", &h, &m, &sec ) < 2 || h < 0 || h > 24 || m < 0 || m > 59 || sec < 0 || sec > 59 ||
+		( h == 24 && ( m || sec ) ) )
+	{
+		return -1;
+	}
+	return h * 3600 + m * 60 + sec;
+}
+
+static inline int ScheduleParseDayName( const char * text )
+{
+	static const char * names[7] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+	for( int i = 0; i < 7; i++ )
+	{
+		if( strncmp( text, names[i], 3 ) == 0 )
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Parses "mon-fri", "sat,sun", "weekdays", "weekends" and so on. Returns the day mask, or -1.
+static inline int ScheduleParseDays( const char * text )
+{
+	if( strcmp( text, "weekdays" ) == 0 ) return 0x3e;
+	if( strcmp( text, "weekends" ) == 0 ) return 0x41;
+	int mask = 0;
+	while( *text )
+	{
+		int a = ScheduleParseDayName( text );
+		if( a < 0 )
+		{
+			return -1;
+		}
+		text += 3;
+		int b = a;
+		if( *text == '-' )
+		{
+			b = ScheduleParseDayName( text + 1 );
+			if( b < 0 )
+			{
+				return -1;
+			}
+			text += 4;
+		}
+		for( int d = a; ; d = ( d + 1 ) % 7 )
+		{
+			mask |= 1 << d;
+			if( d == b ) break;
+		}
+		if( *text == ',' )
+		{
+			text++;
+		}
+		else if( *text )
+		{
+			return -1;
+		}
+	}
+	return mask;
+}
+
+// Parses one rule (see the top of this file). Returns 0 on success.
+static inline int ScheduleParseRule( struct ScheduleRule * r, const char * text )
+{
+	char word[64];
+	char arg[64];
+	int used;
+	memset( r, 0, sizeof( *r ) );
+	r->dayMask = SCHEDULE_ALL_DAYS;
+
+	if( sscanf( text, "%63s %63s%n", word, arg, &used ) != 2 )
+	{
+		return -1;
+	}
+	text += used;
+	if( strcmp( word, "every" ) == 0 )
+	{
+		r->kind = ScheduleRule_Every;
+		r->periodSeconds = ScheduleParseDuration( arg );
+		if( r->periodSeconds <= 0 )
+		{
+			return -1;
+		}
+	}
+	else if( strcmp( word, "at" ) == 0 )
+	{
+		r->kind = ScheduleRule_At;
+		r->atSeconds = ScheduleParseTimeOfDay( arg );
+		if( r->atSeconds < 0 )
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		return -1;
+	}
+
+	while( sscanf( text, "%63s%n", word, &used ) == 1 )
+	{
+		text += used;
+		if( strcmp( word, "#" ) == 0 || word[0] == '#' )
+		{
+			break;
+		}
+		if( sscanf( text, "%63s%n", arg, &used ) != 1 )
+		{
+			return -1;
+		}
+		text += used;
+		if( strcmp( word, "offset" ) == 0 )
+		{
+			r->offsetSeconds = ScheduleParseDuration( arg );
+			if( r->offsetSeconds < 0 ) return -1;
+		}
+		else if( strcmp( word, "type" ) == 0 )
+		{
+			// No type name is anywhere near this long, so it's a typo rather than something to cut short.
+			if( strlen( arg ) >= sizeof( r->typeName ) ) return -1;
+			strcpy( r->typeName, arg );
+		}
+		else if( strcmp( word, "on" ) == 0 )
+		{
+			int mask = ScheduleParseDays( arg );
+			if( mask <= 0 ) return -1;
+			r->dayMask = mask;
+		}
+		else if( strcmp( word, "from" ) == 0 )
+		{
+			char to[8];
+			char until[64];
+			r->windowStart = ScheduleParseTimeOfDay( arg );
+			if( r->windowStart < 0 || sscanf( text, "%7s %63s%n", to, until, &used ) != 2 || strcmp( to, "to" ) != 0 )
+			{
+				return -1;
+			}
+			text += used;
+			r->windowEnd = ScheduleParseTimeOfDay( until );
+			if( r->windowEnd < 0 ) return -1;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static inline int ScheduleAddRule( struct Schedule * s, const struct ScheduleRule * r )
+{
+	if( s->ruleCount >= SCHEDULE_MAX_RULES )
+	{
+		return -1;
+	}
+	s->rules[s->ruleCount] = *r;
+	return s->ruleCount++;
+}
+
+// Works out every rule's first fire time after now and builds the heap.
+static inline void ScheduleStart( struct Schedule * s, time_t now )
+{
+	s->heapCount = 0;
+	for( int i = 0; i < s->ruleCount; i++ )
+	{
+		time_t next = ScheduleRuleNext( &s->rules[i], now );
+		if( next )
+		{
+			ScheduleHeapPush( s, next, i );
+		}
+	}
+}
+
+// The next time anything is due, or 0 if nothing will ever fire.
+static inline time_t SchedulePeek( const struct Schedule * s )
+{
+	return s->heapCount ? s->heap[0].next : 0;
+}
+
+// Takes the rule at the top of the heap, puts it back in with its following fire time, and
+// returns which rule it was (when says when it was meant to fire). Returns -1 if empty.
+static inline int SchedulePop( struct Schedule * s, time_t * when )
+{
+	if( !s->heapCount )
+	{
+		return -1;
+	}
+	struct ScheduleEntry top = s->heap[0];
+	ScheduleHeapRemoveTop( s );
+	time_t next = ScheduleRuleNext( &s->rules[top.rule], top.next );
+	if( next )
+	{
+		ScheduleHeapPush( s, next, top.rule );
+	}
+	if( when )
+	{
+		*when = top.next;
+	}
+	return top.rule;
+}
+
+#endif
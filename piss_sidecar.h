@@ -0,0 +1,113 @@
+#ifndef _PISS_SIDECAR_H
+#define _PISS_SIDECAR_H
+
+// Context for each capture: where the headset and hands were, which app was running and how
+// the compositor was doing. It's all written as fixed size binary records to one append-only
+// file, Screenshots\captures.bin, so finding every screenshot taken in some app or at some spot
+// in the room is a matter of reading through that one file, not opening every image.
+//
+// The record is filled in on the main thread right after the screenshot is asked for, but only
+// written out in batches by a worker, so the capture itself never waits on the file.
+//
+// Records are little endian, SIDECAR_RECORD_SIZE bytes, and start with SIDECAR_MAGIC and the
+// version so readers can check they're in step. Matrices are the usual OpenVR 3x4 row-major
+// device to standing space transform, in meters.
+//
+// Needs openvr_capi.h included first.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIDECAR_MAGIC 0x52444353		// "SCDR"
+#define SIDECAR_VERSION 1
+#define SIDECAR_RECORD_SIZE 544
+#define SIDECAR_BATCH 64
+
+enum SidecarDevice
+{
+	SidecarDevice_Head,
+	SidecarDevice_LeftHand,
+	SidecarDevice_RightHand,
+	SIDECAR_DEVICES
+};
+
+enum SidecarFlags
+{
+	SidecarFlag_Gated = 1,
+	SidecarFlag_Late = 2,
+	SidecarFlag_CatchUp = 4,
+	SidecarFlag_Manual = 8,
+};
+
+struct SidecarPose
+{
+	float matrix[3][4];
+	float velocity[3];			// m/s
+	float angularVelocity[3];	// rad/s
+	int32_t trackingResult;		// ETrackingResult
+	uint8_t valid;
+	uint8_t connected;
+	uint8_t pad[2];
+};
+
+struct SidecarRecord
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	int64_t scheduled;			// unix time the capture was due
+	int64_t taken;				// unix time it was asked for
+	uint32_t handle;
+	int32_t type;				// EVRScreenshotType, or 6 for a mirror capture
+	int32_t shot;				// which screenshot of a burst
+	uint32_t flags;				// SidecarFlags
+	float frameGpuMs;			// the app's last frame
+	float frameIntervalMs;
+	float compositorGpuMs;
+	float droppedRate;			// dropped frames per frame over the last FRAME_TIMING_HISTORY frames
+	float reprojectedRate;
+	uint32_t pad;
+	struct SidecarPose poses[SIDECAR_DEVICES];
+	char appKey[128];			// scene app, empty if there wasn't one
+	char name[112];				// image path relative to the exe, without the extension
+};
+
+_Static_assert( sizeof( struct SidecarRecord ) == SIDECAR_RECORD_SIZE, "sidecar records have a fixed layout" );
+
+struct SidecarBatch
+{
+	atomic_int writing;			// handed to a worker, leave it alone
+	int count;
+	double started;				// when the first record went in
+	struct SidecarRecord records[SIDECAR_BATCH];
+};
+
+static inline void SidecarPoseFrom( struct SidecarPose * out, const TrackedDevicePose_t * pose )
+{
+	memcpy( out->matrix, pose->mDeviceToAbsoluteTracking.m, sizeof( out->matrix ) );
+	memcpy( out->velocity, pose->vVelocity.v, sizeof( out->velocity ) );
+	memcpy( out->angularVelocity, pose->vAngularVelocity.v, sizeof( out->angularVelocity ) );
+	out->trackingResult = pose->eTrackingResult;
+	out->valid = pose->bPoseIsValid;
+	out->connected = pose->bDeviceIsConnected;
+}
+
+// Appends a batch to the file and hands it back empty. Returns false if it couldn't be written.
+static inline bool SidecarWrite( struct SidecarBatch * b, const char * path )
+{
+	bool ok = false;
+	FILE * f = fopen( path, "ab" );
+	if( f )
+	{
+		ok = fwrite( b->records, sizeof( b->records[0] ), b->count, f ) == (size_t)b->count;
+		ok = fclose( f ) == 0 && ok;
+	}
+	b->count = 0;
+	atomic_store( &b->writing, 0 );
+	return ok;
+}
+
+#endif
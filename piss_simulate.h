@@ -0,0 +1,240 @@
+#ifndef _PISS_SIMULATE_H
+#define _PISS_SIMULATE_H
+
+// Checking the scheduler against a virtual clock. PISS --simulate runs the normal main loop, but
+// every clock it reads is a virtual one that jumps straight to whatever the loop is waiting
+// for, so a year of schedule goes by in seconds. Nothing is captured, each capture the loop
+// starts is just written down here.
+//
+// Afterwards the captures are compared with a list worked out the slow way, by stepping through
+// every period (or every day for "at" rules) and checking each rule's days and window there.
+// Anything in that list that never happened was missed, anything that happened twice was a
+// duplicate, and anything that happened but isn't in the list shouldn't have.
+//
+// Needs piss_schedule.h included first.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct SimulatedCapture
+{
+	int64_t when;			// when it was due
+	int32_t type;
+};
+
+struct SimulatedLog
+{
+	struct SimulatedCapture * items;
+	size_t count;
+	size_t capacity;
+};
+
+struct SimulatedResult
+{
+	long long expected;
+	long long taken;
+	long long missed;
+	long long duplicates;
+	long long unexpected;
+};
+
+static inline bool SimulatedLogAdd( struct SimulatedLog * log, time_t when, int type )
+{
+	if( log->count == log->capacity )
+	{
+		size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+		struct SimulatedCapture * items = realloc( log->items, capacity * sizeof( items[0] ) );
+		if( !items )
+		{
+			return false;
+		}
+		log->items = items;
+		log->capacity = capacity;
+	}
+	log->items[log->count].when = when;
+	log->items[log->count].type = type;
+	log->count++;
+	return true;
+}
+
+static inline void SimulatedLogFree( struct SimulatedLog * log )
+{
+	free( log->items );
+	log->items = NULL;
+	log->count = log->capacity = 0;
+}
+
+static inline int SimulatedCaptureCompare( const void * a, const void * b )
+{
+	const struct SimulatedCapture * x = a;
+	const struct SimulatedCapture * y = b;
+	if( x->when != y->when ) return x->when < y->when ? -1 : 1;
+	return ( x->type > y->type ) - ( x->type < y->type );
+}
+
+static inline void SimulatedLogSort( struct SimulatedLog * log )
+{
+	qsort( log->items, log->count, sizeof( log->items[0] ), SimulatedCaptureCompare );
+}
+
+// The expected list is worked out straight from mktime and localtime, and none of the helpers
+// in piss_schedule.h, so a bug in those shows up as a difference rather than being repeated here.
+static inline void SimulateLocalTime( time_t t, struct tm * out )
+{
+#if defined( _WIN32 )
+	localtime_s( out, &t );
+#else
+	localtime_r( &t, out );
+#endif
+}
+
+// Day of the week for a date, 0 for Sunday, without asking the C library.
+static inline int SimulateWeekday( int year, int month, int day )
+{
+	static const int offsets[] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+	if( month < 3 )
+	{
+		year--;
+	}
+	return ( year + year / 4 - year / 100 + year / 400 + offsets[month - 1] + day ) % 7;
+}
+
+// Whether a rule wants a capture at t, going by the local date and time there.
+static inline bool SimulateAllowed( const struct ScheduleRule * r, time_t t )
+{
+	struct tm lt;
+	SimulateLocalTime( t, &lt );
+	if( !( r->dayMask & ( 1 << SimulateWeekday( lt.tm_year + 1900, lt.tm_mon + 1, lt.tm_mday ) ) ) )
+	{
+		return false;
+	}
+	int second = lt.tm_hour * 3600 + lt.tm_min * 60 + lt.tm_sec;
+	if( r->windowStart == r->windowEnd )
+	{
+		return true;
+	}
+	if( r->windowStart < r->windowEnd )
+	{
+		return second >= r->windowStart && second < r->windowEnd;
+	}
+	return second >= r->windowStart || second < r->windowEnd;
+}
+
+// Every capture the schedule should take strictly between start and end, sorted, with rules of
+// the same type on the same second counted once (they share a screenshot).
+static inline bool SimulateExpected( const struct Schedule * s, time_t start, time_t end, struct SimulatedLog * out )
+{
+	struct tm first;
+	SimulateLocalTime( start, &first );
+	int days = (int)( ( end - start ) / 86400 ) + 2;
+
+	for( int i = 0; i < s->ruleCount; i++ )
+	{
+		const struct ScheduleRule * r = &s->rules[i];
+		if( r->kind == ScheduleRule_At )
+		{
+			// The day before start too, in case it's a 24:00.
+			for( int d = -1; d <= days; d++ )
+			{
+				struct tm at;
+				memset( &at, 0, sizeof( at ) );
+				at.tm_year = first.tm_year;
+				at.tm_mon = first.tm_mon;
+				at.tm_mday = first.tm_mday + d;
+				at.tm_hour = r->atSeconds / 3600;
+				at.tm_min = r->atSeconds / 60 % 60;
+				at.tm_sec = r->atSeconds % 60;
+				at.tm_isdst = -1;
+				time_t t = mktime( &at );
+				if( t > start && t < end && SimulateAllowed( r, t ) && !SimulatedLogAdd( out, t, r->type ) )
+				{
+					return false;
+				}
+			}
+			continue;
+		}
+		long long past = ( (long long)start - r->offsetSeconds ) % r->periodSeconds;
+		if( past < 0 )
+		{
+			past += r->periodSeconds;
+		}
+		for( time_t t = start - past + r->periodSeconds; t < end; t += r->periodSeconds )
+		{
+			if( SimulateAllowed( r, t ) && !SimulatedLogAdd( out, t, r->type ) )
+			{
+				return false;
+			}
+		}
+	}
+
+	SimulatedLogSort( out );
+	size_t kept = 0;
+	for( size_t i = 0; i < out->count; i++ )
+	{
+		if( !kept || SimulatedCaptureCompare( &out->items[kept - 1], &out->items[i] ) != 0 )
+		{
+			out->items[kept++] = out->items[i];
+		}
+	}
+	out->count = kept;
+	return true;
+}
+
+static inline void SimulatePrintCapture( const char * what, const struct SimulatedCapture * c )
+{
+	char text[32];
+	time_t t = (time_t)c->when;
+	struct tm lt;
+	SimulateLocalTime( t, &lt );
+	strftime( text, sizeof( text ), "%Y-%m-%d %H:%M:%S", &lt );
+	printf( "  %s: %s (type %d)\n", what, text, c->type );
+}
+
+// Compares what was taken (sorted here) against what was expected (from SimulateExpected()),
+// printing the first few differences.
+static inline void SimulateCompare( const struct SimulatedLog * expected, struct SimulatedLog * taken, struct SimulatedResult * result )
+{
+	const int shown = 10;
+	int printed = 0;
+	SimulatedLogSort( taken );
+	memset( result, 0, sizeof( *result ) );
+	result->expected = expected->count;
+	result->taken = taken->count;
+
+	size_t e = 0, t = 0;
+	while( e < expected->count || t < taken->count )
+	{
+		int order = e == expected->count ? 1 : t == taken->count ? -1 :
+			SimulatedCaptureCompare( &expected->items[e], &taken->items[t] );
+		if( order < 0 )
+		{
+			if( printed++ < shown ) SimulatePrintCapture( "missed", &expected->items[e] );
+			result->missed++;
+			e++;
+			continue;
+		}
+		if( order > 0 )
+		{
+			if( t && SimulatedCaptureCompare( &taken->items[t - 1], &taken->items[t] ) == 0 )
+			{
+				if( printed++ < shown ) SimulatePrintCapture( "taken twice", &taken->items[t] );
+				result->duplicates++;
+			}
+			else
+			{
+				if( printed++ < shown ) SimulatePrintCapture( "not due", &taken->items[t] );
+				result->unexpected++;
+			}
+			t++;
+			continue;
+		}
+		e++;
+		t++;
+	}
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _PISS_STATS_H
+#define _PISS_STATS_H
+
+// A small HDR style histogram for timings. Values are bucketed on a log scale with 16 linear
+// steps per power of two, so anything from a microsecond to days fits in a fixed 1024 counters
+// and every bucket is within about 6% of the real value. Recording is a couple of shifts and an
+// add, nothing is ever allocated, and percentiles can be read out at any time.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS ( 1 << HISTOGRAM_SUB_BITS )
+#define HISTOGRAM_BUCKETS ( 64 * HISTOGRAM_SUB_BUCKETS )
+
+struct Histogram
+{
+	uint32_t counts[HISTOGRAM_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+};
+
+static inline int HistogramBucket( uint64_t v )
+{
+	if( v < HISTOGRAM_SUB_BUCKETS )
+	{
+		return (int)v;
+	}
+	int msb = 63;
+	while( !( v >> msb ) )
+	{
+		msb--;
+	}
+	int shift = msb - HISTOGRAM_SUB_BITS;
+	return ( shift + 1 ) * HISTOGRAM_SUB_BUCKETS + (int)( ( v >> shift ) - HISTOGRAM_SUB_BUCKETS );
+}
+
+// The largest value that would land in a bucket.
+static inline uint64_t HistogramBucketTop( int bucket )
+{
+	if( bucket < HISTOGRAM_SUB_BUCKETS )
+	{
+		return bucket;
+	}
+	int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+	return ( ( HISTOGRAM_SUB_BUCKETS + sub + 1 ) << shift ) - 1;
+}
+
+static inline void HistogramRecord( struct Histogram * h, uint64_t v )
+{
+	h->counts[HistogramBucket( v )]++;
+	if( !h->total || v < h->min ) h->min = v;
+	if( v > h->max ) h->max = v;
+	h->total++;
+	h->sum += (double)v;
+}
+
+// Records a time in seconds with microsecond resolution. Negative times (clock weirdness) count as 0.
+static inline void HistogramRecordSeconds( struct Histogram * h, double seconds )
+{
+	HistogramRecord( h, seconds > 0 ? (uint64_t)( seconds * 1000000.0 + 0.5 ) : 0 );
+}
+
+// The value below which fraction (0 to 1) of everything recorded falls.
+static inline uint64_t HistogramPercentile( const struct Histogram * h, double fraction )
+{
+	if( !h->total )
+	{
+		return 0;
+	}
+	uint64_t want = (uint64_t)( fraction * h->total + 0.5 );
+	if( want < 1 ) want = 1;
+	uint64_t seen = 0;
+	for( int i = 0; i < HISTOGRAM_BUCKETS; i++ )
+	{
+		seen += h->counts[i];
+		if( seen >= want )
+		{
+			uint64_t top = HistogramBucketTop( i );
+			return top < h->max ? top : h->max;
+		}
+	}
+	return h->max;
+}
+
+// One line summary in milliseconds. Jitter is how far the 99th percentile is from the median.
+static inline void HistogramPrint( FILE * f, const char * name, const struct Histogram * h )
+{
+	uint64_t p50 = HistogramPercentile( h, 0.5 );
+	uint64_t p99 = HistogramPercentile( h, 0.99 );
+	fprintf( f, "%-12s n=%-6llu p50=%10.3fms p99=%10.3fms max=%10.3fms jitter=%10.3fms\n", name,
+		(unsigned long long)h->total, p50 / 1000.0, p99 / 1000.0, h->max / 1000.0, ( p99 - p50 ) / 1000.0 );
+}
+
+// The same as a JSON object member, for scripts to compare between runs.
+static inline void HistogramPrintJson( FILE * f, const char * name, const struct Histogram * h )
+{
+	fprintf( f, "\"%s\": { \"n\": %llu, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, \"mean_ms\": %.3f }", name,
+		(unsigned long long)h->total, HistogramPercentile( h, 0.5 ) / 1000.0, HistogramPercentile( h, 0.99 ) / 1000.0,
+		h->max / 1000.0, h->total ? h->sum / h->total / 1000.0 : 0.0 );
+}
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef _PISS_WORKERS_H
+#define _PISS_WORKERS_H
+
+// A small pool of worker threads for everything that happens to a screenshot after SteamVR has
+// saved it (measuring, hashing, indexing), so the main loop never sits waiting on the disk while
+// a capture is due.
+//
+// Jobs go through a bounded lock-free queue, Dmitry Vyukov's ring: every cell carries a sequence
+// number saying whether it's ready to be filled or ready to be taken, so pushing and popping are
+// just a compare-and-swap on a position counter and nobody ever holds a lock. Any thread can
+// push (a job can queue up the next step for the same screenshot) and any worker can pop. A
+// semaphore counts the jobs waiting so idle workers sleep instead of spinning.
+//
+// Finished jobs come back through a second queue of the same kind, and the main thread picks
+// them up with WorkerPoolDrain(). That keeps all the counters and histograms on the main thread.
+//
+// Needs os_generic.h and piss_handles.h included first.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WORKER_QUEUE_SIZE 64		// must be a power of two
+#define MAX_WORKERS 8
+
+struct WorkerJob
+{
+	int kind;
+	double queued;					// OGGetAbsoluteTime() when it went in the queue
+	double started;
+	double finished;
+	bool last;						// nothing comes after this step
+	struct PendingCapture * capture;	// the screenshot it's for, held by whoever queued it
+	long long bytes;				// whatever the jobs want to pass along to the next step
+	long long previewBytes;
+	uint64_t hash;
+	void * data;					// anything else a job needs, owned by whoever queued it
+};
+
+struct WorkerQueueCell
+{
+	atomic_size_t sequence;
+	struct WorkerJob job;
+};
+
+struct WorkerQueue
+{
+	struct WorkerQueueCell cells[WORKER_QUEUE_SIZE];
+	atomic_size_t head;				// next cell to take from
+	atomic_size_t tail;				// next cell to fill
+};
+
+static inline void WorkerQueueInit( struct WorkerQueue * q )
+{
+	for( size_t i = 0; i < WORKER_QUEUE_SIZE; i++ )
+	{
+		atomic_store_explicit( &q->cells[i].sequence, i, memory_order_relaxed );
+	}
+	atomic_store( &q->head, 0 );
+	atomic_store( &q->tail, 0 );
+}
+
+// Returns false if the queue is full.
+static inline bool WorkerQueuePush( struct WorkerQueue * q, const struct WorkerJob * job )
+{
+	size_t pos = atomic_load_explicit( &q->tail, memory_order_relaxed );
+	for( ;; )
+	{
+		struct WorkerQueueCell * cell = &q->cells[pos & ( WORKER_QUEUE_SIZE - 1 )];
+		intptr_t diff = (intptr_t)atomic_load_explicit( &cell->sequence, memory_order_acquire ) - (intptr_t)pos;
+		if( diff == 0 )
+		{
+			if( atomic_compare_exchange_weak_explicit( &q->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed ) )
+			{
+				cell->job = *job;
+				atomic_store_explicit( &cell->sequence, pos + 1, memory_order_release );
+				return true;
+			}
+		}
+		else if( diff < 0 )
+		{
+			return false;
+		}
+		else
+		{
+			pos = atomic_load_explicit( &q->tail, memory_order_relaxed );
+		}
+	}
+}
+
+// Returns false if there's nothing ready to take. That can also briefly happen while another
+// thread is halfway through pushing, so callers that know a job is there should just try again.
+static inline bool WorkerQueuePop( struct WorkerQueue * q, struct WorkerJob * job )
+{
+	size_t pos = atomic_load_explicit( &q->head, memory_order_relaxed );
+	for( ;; )
+	{
+		struct WorkerQueueCell * cell = &q->cells[pos & ( WORKER_QUEUE_SIZE - 1 )];
+		intptr_t diff = (intptr_t)atomic_load_explicit( &cell->sequence, memory_order_acquire ) - (intptr_t)( pos + 1 );
+		if( diff == 0 )
+		{
+			if( atomic_compare_exchange_weak_explicit( &q->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed ) )
+			{
+				*job = cell->job;
+				atomic_store_explicit( &cell->sequence, pos + WORKER_QUEUE_SIZE, memory_order_release );
+				return true;
+			}
+		}
+		else if( diff < 0 )
+		{
+			return false;
+		}
+		else
+		{
+			pos = atomic_load_explicit( &q->head, memory_order_relaxed );
+		}
+	}
+}
+
+// Roughly how many jobs are waiting, exact if nobody else is pushing or popping.
+static inline int WorkerQueueDepth( struct WorkerQueue * q )
+{
+	return (int)( atomic_load( &q->tail ) - atomic_load( &q->head ) );
+}
+
+// Does one job. Returns the kind of job that should run next for the same screenshot, or -1 if
+// that was the last step. Runs on a worker thread, so it mustn't touch anything the main thread does.
+typedef int (*WorkerJobFn)( struct WorkerJob * job );
+
+// Called on the main thread for each finished job.
+typedef void (*WorkerDoneFn)( const struct WorkerJob * job );
+
+struct WorkerPool
+{
+	struct WorkerQueue jobs;
+	struct WorkerQueue done;
+	og_sema_t waiting;				// counts the jobs in the queue
+	og_thread_t threads[MAX_WORKERS];
+	int threadCount;				// how many were started, still there for the stats after stopping
+	bool running;					// false before start and once they've been stopped
+	WorkerJobFn run;
+	atomic_int pending;				// jobs queued or running, including steps still to come
+	atomic_int stopping;
+};
+
+// Runs one step of a job and says what comes next, marking when it started and finished.
+static inline int WorkerPoolStep( struct WorkerPool * p, struct WorkerJob * job )
+{
+	job->started = OGGetAbsoluteTime();
+	int next = p->run( job );
+	job->finished = OGGetAbsoluteTime();
+	job->last = next < 0;
+	return next;
+}
+
+static inline void * WorkerThread( void * v )
+{
+	struct WorkerPool * p = v;
+	struct WorkerJob job;
+	for( ;; )
+	{
+		OGLockSema( p->waiting );
+		while( !WorkerQueuePop( &p->jobs, &job ) )
+		{
+			if( atomic_load( &p->stopping ) )
+			{
+				return 0;
+			}
+			OGUSleep( 100 );
+		}
+
+		int next = WorkerPoolStep( p, &job );
+		while( !WorkerQueuePush( &p->done, &job ) )
+		{
+			// The main thread picks these up every time round its loop, so this is never long.
+			OGUSleep( 1000 );
+		}
+		if( next >= 0 )
+		{
+			job.kind = next;
+			job.queued = job.finished;
+			if( WorkerQueuePush( &p->jobs, &job ) )
+			{
+				OGUnlockSema( p->waiting );
+				continue;
+			}
+			// Full, so just carry on with it here rather than lose it.
+			while( next >= 0 )
+			{
+				next = WorkerPoolStep( p, &job );
+				while( !WorkerQueuePush( &p->done, &job ) )
+				{
+					OGUSleep( 1000 );
+				}
+				job.kind = next;
+				job.queued = job.finished;
+			}
+		}
+		atomic_fetch_sub( &p->pending, 1 );
+	}
+}
+
+// Starts threads workers (0 runs every job on the calling thread instead).
+static inline void WorkerPoolStart( struct WorkerPool * p, int threads, WorkerJobFn run )
+{
+	WorkerQueueInit( &p->jobs );
+	WorkerQueueInit( &p->done );
+	p->run = run;
+	atomic_store( &p->pending, 0 );
+	atomic_store( &p->stopping, 0 );
+	p->waiting = OGCreateSema();
+	p->threadCount = 0;
+	if( threads > MAX_WORKERS )
+	{
+		threads = MAX_WORKERS;
+	}
+	for( int i = 0; i < threads; i++ )
+	{
+		og_thread_t t = OGCreateThread( WorkerThread, p );
+		if( t )
+		{
+			p->threads[p->threadCount++] = t;
+		}
+	}
+	p->running = p->threadCount > 0;
+}
+
+// Queues a job. If there are no workers or the queue is full the job is done right here, and
+// done is called for each step, so nothing is ever dropped. Returns false in that case.
+static inline bool WorkerPoolSubmit( struct WorkerPool * p, struct WorkerJob * job, WorkerDoneFn done )
+{
+	job->queued = OGGetAbsoluteTime();
+	if( p->running )
+	{
+		atomic_fetch_add( &p->pending, 1 );
+		if( WorkerQueuePush( &p->jobs, job ) )
+		{
+			OGUnlockSema( p->waiting );
+			return true;
+		}
+		atomic_fetch_sub( &p->pending, 1 );
+	}
+	for( int next = job->kind; next >= 0; )
+	{
+		next = WorkerPoolStep( p, job );
+		done( job );
+		job->kind = next;
+		job->queued = job->finished;
+	}
+	return false;
+}
+
+// Hands every finished job to done. Returns how many there were.
+static inline int WorkerPoolDrain( struct WorkerPool * p, WorkerDoneFn done )
+{
+	struct WorkerJob job;
+	int count = 0;
+	while( WorkerQueuePop( &p->done, &job ) )
+	{
+		done( &job );
+		count++;
+	}
+	return count;
+}
+
+// Waits up to timeout seconds for the queued jobs to finish, then stops the workers. Jobs still
+// going after that are abandoned. Returns how many.
+static inline int WorkerPoolStop( struct WorkerPool * p, double timeout, WorkerDoneFn done )
+{
+	double giveUp = OGGetAbsoluteTime() + timeout;
+	while( atomic_load( &p->pending ) && OGGetAbsoluteTime() < giveUp )
+	{
+		WorkerPoolDrain( p, done );
+		OGUSleep( 1000 );
+	}
+	int abandoned = atomic_load( &p->pending );
+	atomic_store( &p->stopping, 1 );
+	if( !abandoned )
+	{
+		for( int i = 0; i < p->threadCount; i++ )
+		{
+			OGUnlockSema( p->waiting );
+		}
+		for( int i = 0; i < p->threadCount; i++ )
+		{
+			OGJoinThread( p->threads[i] );
+		}
+		p->running = false;
+	}
+	WorkerPoolDrain( p, done );
+	return abandoned;
+}
+
+#endif